@@ -28,10 +28,29 @@ public:
     return (uint16_t)::micros();
   }
   
+  static inline uint16_t millis16() __attribute__((always_inline)) {
+    return (uint16_t)::millis();
+  }
+  
   static inline void delay(uint16_t ms) {
     ::delay(ms);
   }
   
+  /** 
+   * Busy-waits for exactly the given number of CPU cycles on AVR (approximately elsewhere). 
+   * Handy for bit-banged protocols where the cycles taken by the pin operations are known at compile time.
+   */
+  template<uint32_t cycles>
+  static inline void delayCycles() {
+    if (cycles > 0) {
+      #if defined(ARDUINO_ARCH_AVR)
+      __builtin_avr_delay_cycles(cycles);
+      #else
+      delayMicroseconds(cycles * 1000000.0 / F_CPU);
+      #endif
+    }
+  }
+  
   /** Busy-waits for the specified number of microseconds. */
   static inline void delayMicroseconds(double us) __attribute__((always_inline)) {
     #if defined(ARDUINO_ARCH_AVR)
@@ -69,6 +69,17 @@ public:
 		T::endWritingPage();
 	}	
 	
+	/** 
+	 * Writes `pages` pages of `cols` bytes each starting at the given column and page, the data is laid out page 
+	 * by page, i.e. `cols` bytes of the top page, then `cols` bytes of the next one, etc. (the layout of Framebuffer). 
+	 * Every page is a separate page write here, displays supporting a better way can provide their own version.
+	 */
+	static void writePages(uint8_t col, uint8_t page, uint8_t cols, uint8_t pages, const uint8_t *data) {
+		for (uint8_t p = page; p < page + pages; p++, data += cols) {
+			T::fillPage(col, col + cols - 1, p, data);
+		}
+	}
+	
 	/** Fills a page-aligned rectangle defined by (start_col, start_page) and (end_col, end_page) points. */
 	static void clear(
 		uint8_t start_col = 0, 
@@ -119,18 +130,160 @@ class Display8Constants {
 	static const uint8_t Rows = 8 * Pages;
 	static const uint8_t Cols = 128;
 	
+	/** Approximate cost of beginWritingPage()/endWritingPage() in data bytes, see ShadowDisplay8. */
+	static const uint8_t PageAddressingOverhead = 8;
+	
 	// Should support MonochromeDisplayPageOutput.
 };
 
+/**
+ * Keeps a copy of the memory of a Display8-compatible display in RAM (none of the supported controllers can be read 
+ * back), so only the bytes that have actually changed are sent to it.
+ * 
+ * It has the same page output interface as the displays themselves, so it can be used in their place with Display8 
+ * functions, consoles, etc. Every page write is compared against the copy and once it's done (endWritingPage()) 
+ * only the changed spans of columns are sent. Spans separated by up to `maxGap` unchanged columns are merged, 
+ * because re-addressing the display would cost more than sending the unchanged bytes. The default is taken from 
+ * `PageAddressingOverhead` of the display, i.e. the approximate cost of beginWritingPage() in bytes.
+ * 
+ * The contents of the display are unknown in the beginning and after invalidate(), so a page is sent as a whole 
+ * until it is completely overwritten. Other functions of the display (contrast, etc) should be called directly.
+ * 
+ * Note that the copy takes Cols * Pages bytes of RAM, e.g. 1KB for 128x64 displays.
+ */
+template<typename lcd, uint8_t maxGap = lcd::PageAddressingOverhead>
+class ShadowDisplay8 : public Display8< ShadowDisplay8<lcd, maxGap> > {
+	
+public:
+	
+	static const uint8_t Pages = lcd::Pages;
+	static const uint8_t Rows = lcd::Rows;
+	static const uint8_t Cols = lcd::Cols;
+	
+private:
+	
+	static_assert(Pages <= 8, "Up to 8 pages are supported");
+	
+	typedef ShadowDisplay8<lcd, maxGap> Self;
+	
+	uint8_t _shadow[Pages][Cols];
+	
+	// A bit for every column of the page being written, set when the corresponding byte differs from the copy.
+	uint8_t _dirty[(Cols + 7) / 8];
+	
+	// A bit for every page that was completely written since the beginning or since the last invalidate().
+	uint8_t _known;
+	
+	uint8_t _page;
+	uint8_t _startCol;
+	uint8_t _col;
+	
+	static Self& getSelf() {
+		static Self self;
+		return self;
+	}
+	
+	static inline bool isDirty(uint8_t col) {
+		return getSelf()._dirty[col >> 3] & _BV(col & 7);
+	}
+	
+	// Sends the changed spans of the current page.
+	static void flushPage() {
+		
+		Self& self = getSelf();
+		
+		const uint8_t *page = self._shadow[self._page];
+		
+		uint8_t col = self._startCol;
+		while (col < self._col) {
+			
+			if (!isDirty(col)) {
+				col++;
+				continue;
+			}
+			
+			// Extending the span while the gaps in it are not too long.
+			uint8_t start = col;
+			uint8_t end = ++col;
+			while (col < self._col && col - end <= maxGap) {
+				if (isDirty(col)) {
+					end = col + 1;
+				}
+				col++;
+			}
+			
+			lcd::beginWritingPage(start, self._page);
+			for (uint8_t c = start; c < end; c++) {
+				lcd::writePageByte(page[c]);
+			}
+			lcd::endWritingPage();
+		}
+	}
+	
+public:
+	
+	/** Forgets what is on the display, so everything is sent again. E.g. when the display has been reset. */
+	static void invalidate() {
+		getSelf()._known = 0;
+	}
+	
+	/** @{ */
+	/** Page output, see Display8. */
+	
+	static void beginWritingPage(uint8_t col, uint8_t page) {
+		Self& self = getSelf();
+		self._page = page;
+		self._startCol = self._col = col;
+		memset(self._dirty, 0, sizeof(self._dirty));
+	}
+	
+	static void writePageByte(uint8_t b) {
+		
+		Self& self = getSelf();
+		
+		uint8_t col = self._col;
+		if (col >= Cols)
+			return;
+		
+		uint8_t& s = self._shadow[self._page][col];
+		if (s != b || !(self._known & _BV(self._page))) {
+			s = b;
+			self._dirty[col >> 3] |= _BV(col & 7);
+		}
+		
+		self._col = col + 1;
+	}
+	
+	static void endWritingPage() {
+		
+		flushPage();
+		
+		Self& self = getSelf();
+		if (self._startCol == 0 && self._col == Cols) {
+			self._known |= _BV(self._page);
+		}
+	}
+	
+	/** @} */
+};
+
 /**
  * Turns a monochrome LCD supporting simple text output into a simple text-only display with autoscrolling ("console").
  * Note that we don't inherit Arduino's Print class to keep the compiled code size small.
- * TODO: use the Print<> template for the printing functions
+ * 
+ * Only the rows that have changed since the last draw() are redrawn. When `hardwareScrolling` is true, then every row 
+ * of the console stays in the same page of the display memory and scrolling is done by changing the display start line 
+ * (see SSD1306::setDisplayStartLine()), so a line feed costs a single page upload instead of all of them. 
+ * This requires the display to have exactly 8 pages (i.e. 64 rows) and assumes the start line to be 0 initially.
  */
-template<typename lcd, typename font = Font8Console>
-class Display8Console : public Print< Display8Console<lcd, font> > {
+template<typename lcd, typename font = Font8Console, bool hardwareScrolling = false>
+class Display8Console : public Print< Display8Console<lcd, font, hardwareScrolling> > {
   
 private:
+	
+	static_assert(!hardwareScrolling || lcd::Pages == 8, "Hardware scrolling needs a display with 8 pages exactly");
+	
+	static_assert(lcd::Pages <= 8, "Up to 8 pages are supported");
   
 	// We assume that every character occupies at least 4px.
 	static const uint8_t MaxCols = lcd::Cols / 4;
@@ -140,7 +293,30 @@ private:
 	uint8_t _col;
 	uint8_t _rowWidth;
 	uint8_t _filledRows;
-	bool _dirty;
+	
+	// A bit for every row of the buffer that has to be redrawn.
+	uint8_t _dirtyRows;
+	
+	// The row of the buffer that was displayed at the top during the last draw.
+	uint8_t _top;
+	
+	static const uint8_t AllRows = (uint8_t)((1 << lcd::Pages) - 1);
+	
+	// Displays without hardware scrolling do not have to support setDisplayStartLine().
+	template<bool enabled, typename dummy = void>
+	struct StartLine {
+		static inline void set(uint8_t) {}
+	};
+	
+	template<typename dummy>
+	struct StartLine<true, dummy> {
+		static inline void set(uint8_t line) { lcd::setDisplayStartLine(line); }
+	};
+	
+	uint8_t topRow() const {
+		int8_t row = _row - _filledRows;
+		return row < 0 ? row + lcd::Pages : row;
+	}
   
 	void _lf() {
 
@@ -158,6 +334,7 @@ private:
 		}
 		
 		_buffer[_row][_col] = 0;
+		_dirtyRows |= _BV(_row);
 	}
   
 	void cr() {
@@ -172,26 +349,44 @@ private:
 		for (uint8_t row = 0; row < lcd::Pages; row++) {
 			_buffer[row][0] = 0;
 		}
-		_dirty = true;    
+		_dirtyRows = AllRows;
 	}
 	
 	void _draw() {
-
-		if (!_dirty)
-			return;
-
-		_dirty = false;
+		
+		uint8_t top = topRow();
+		
+		// Without hardware scrolling every row moves to a different page when scrolling.
+		if (!hardwareScrolling && top != _top) {
+			_dirtyRows = AllRows;
+		}
 
 		for (uint8_t i = 0; i < lcd::Pages; i++) {
 
-			int8_t row_index = _row - _filledRows + i;
-			if (row_index < 0)
-				row_index += lcd::Pages;
+			uint8_t row_index = top + i;
+			if (row_index >= lcd::Pages)
+				row_index -= lcd::Pages;
+			
+			if (!(_dirtyRows & _BV(row_index)))
+				continue;
+			
+			// With hardware scrolling every row has its own page.
+			uint8_t page = hardwareScrolling ? row_index : i;
 
-			// Print the row and erase the space after the last character.
-			uint8_t width = lcd::drawText(font::data(), 0, i, _buffer[row_index]);
-			lcd::fillPage(width, lcd::Cols - width, i);
+			// Print the row and erase the space after the last character, all within a single page write.
+			Font8::draw<lcd>(font::data(), 0, page, lcd::Cols, _buffer[row_index], Font8::DrawingScale1, 0, true);
 		}
+		
+		_dirtyRows = 0;
+		
+		// Scrolling only after the rows are drawn. The new bottom row reuses the page of the row that is leaving 
+		// the top, so till the start line moves the new text is briefly shown at the top instead of that row. 
+		// (Scrolling first would show the old row at the bottom instead.)
+		if (hardwareScrolling && top != _top) {
+			StartLine<hardwareScrolling>::set(8 * top);
+		}
+		
+		_top = top;
 	}
 
 	void _write(char ch) {
@@ -207,6 +402,8 @@ private:
 			_col++;
 			_buffer[_row][_col] = 0;
 			_rowWidth += width + 1;
+			
+			_dirtyRows |= _BV(_row);
 
 			} else if (ch == '\n') {
 				_lf();
@@ -214,11 +411,9 @@ private:
 
 			cr();      
 		}
-
-		_dirty = true;
 	}  
 
-	typedef Display8Console<lcd, font> Self;
+	typedef Display8Console<lcd, font, hardwareScrolling> Self;
 	
 	static Self& getSelf() {
 		static Self self = Display8Console();
@@ -227,7 +422,7 @@ private:
 
 protected:
 	
-	friend Print< Display8Console<lcd, font> >;
+	friend Print< Display8Console<lcd, font, hardwareScrolling> >;
 	
 	static void lf() {
 		getSelf()._lf();
@@ -241,7 +436,7 @@ protected:
 public:	
   
 	Display8Console() 
-		: _row(0), _col(0), _rowWidth(0), _filledRows(0)
+		: _row(0), _col(0), _rowWidth(0), _filledRows(0), _dirtyRows(AllRows), _top(0)
 	{}
 	
 	/** Clears the console without redrawing it on the LCD. */
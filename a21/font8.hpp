@@ -136,6 +136,8 @@ public:
 	 * supporting Display8RowOutput protocol (see the corresponding prototype).
 	 * The `max_width` tells how many bytes we are allowed to output.
 	 * The `xor_mask` is XORed with every character and when set to 0xFF or 0x7E can be used to render inverted text.
+	 * When `fill` is true, then the rest of `max_width` after the text is filled with the background within the same 
+	 * page write, which is handy to replace the previous contents of the page.
 	 */
 	template<class MonochromeDisplayPageOutput>
 	static uint8_t draw(
@@ -145,11 +147,12 @@ public:
 		uint8_t max_width, 
 		const char *text, 
 		DrawingScale scale = DrawingScale1,
-		uint8_t xor_mask = 0
+		uint8_t xor_mask = 0,
+		bool fill = false
 	) {		
 		uint8_t result;
 		for (uint8_t phase = 0; phase < scale; phase++) {
-			result = drawPhase<MonochromeDisplayPageOutput>(phase, scale, font, col, page, max_width, text, xor_mask);
+			result = drawPhase<MonochromeDisplayPageOutput>(phase, scale, font, col, page, max_width, text, xor_mask, fill);
 		}
 		return result;
 	}   
@@ -206,7 +209,8 @@ protected:
 		uint8_t page,
 		uint8_t max_width, 
 		const char *text,
-		uint8_t xor_mask
+		uint8_t xor_mask,
+		bool fill
 	) {
 		MonochromeDisplayPageOutput::beginWritingPage(col, page + phase);
 
@@ -217,7 +221,7 @@ protected:
 		
 		uint8_t spacing_byte = scaledByte(phase, scale, xor_mask);
 
-		while ((ch = *src++)) {
+		while (width_left > 0 && (ch = *src++)) {
 
 			uint8_t bitmap[8];
 			uint8_t width = dataForCharacter(font, ch, bitmap);
@@ -239,10 +243,18 @@ protected:
 				}
 			}
 		}
+		
+		uint8_t result = max_width - width_left;
+		
+		if (fill) {
+			for (; width_left > 0; width_left--) {
+				MonochromeDisplayPageOutput::writePageByte(spacing_byte);
+			}
+		}
 	
 		MonochromeDisplayPageOutput::endWritingPage();
 
-		return max_width - width_left;
+		return result;
 	}   
    
 public:
@@ -8,14 +8,58 @@
 #include <Arduino.h>
 
 /**
- * Monochrome framebuffer with layout compatible with monochrome LCDs like PCD8544 (from Nokia 3310). 
- * The `display` class should support a single static method helping to transfer the framebuffer:
+ * How Framebuffer transfers its contents to the display. Displays having the writePages() method 
+ * (every Display8) are used via it and their `Pages` constant; the others should support a single static method 
+ * writing the bytes starting at the given column and row (page) and `Rows` constant with the number of rows:
  * static void writeRow(uint8_t col, uint8_t row, const uint8_t *data, uint16_t data_length)
  */
+template<typename display, typename = void>
+class FramebufferOutput {
+public:
+  
+  static const uint8_t Pages = display::Rows;
+  
+  static inline void write(uint8_t page, uint8_t pages, uint8_t cols, const uint8_t *data) {
+    display::writeRow(0, page, data, (uint16_t)pages * cols);
+  }
+};
+
+template<typename display>
+class FramebufferOutput<display, decltype(display::writePages(0, 0, 0, 0, (const uint8_t *)0))> {
+public:
+  
+  static const uint8_t Pages = display::Pages;
+  
+  static inline void write(uint8_t page, uint8_t pages, uint8_t cols, const uint8_t *data) {
+    display::writePages(0, page, cols, pages, data);
+  }
+};
+
+/**
+ * Monochrome framebuffer with layout compatible with monochrome LCDs like PCD8544 (from Nokia 3310) or SSD1306. 
+ * The `display` can be any Display8 (PCD8544, SSD1306, ShadowDisplay8, etc) or a class having writeRow(), 
+ * see FramebufferOutput.
+ */
 template<uint8_t _rows, uint8_t _cols, typename _display>
 class Framebuffer {
+public:
+  
+  /** How the pixels being drawn are combined with the ones already in the framebuffer. */
+  enum DrawingOp : uint8_t {
+    /** The set bits turn the pixels on. */
+    DrawingOpOr,
+    /** The cleared bits turn the pixels off. */
+    DrawingOpAnd,
+    /** The set bits invert the pixels. */
+    DrawingOpXor,
+    /** The pixels are replaced. */
+    DrawingOpCopy
+  };
+  
 private:
 
+  typedef FramebufferOutput<_display> Output;
+  
   int8_t _translationY;
 
   inline uint8_t clamp(int8_t value, uint8_t max) __attribute__((always_inline)) {
@@ -27,6 +71,123 @@ private:
       return value;
   }
   
+  static constexpr uint8_t countBits(uint8_t b) {
+    return b == 0 ? 0 : (b & 1) + countBits(b >> 1);
+  }
+  
+  static constexpr uint8_t countBits(uint8_t b0, uint8_t b1, uint8_t b2, uint8_t b3, uint8_t b4, uint8_t b5, uint8_t b6, uint8_t b7) {
+    return countBits(b0) + countBits(b1) + countBits(b2) + countBits(b3) 
+      + countBits(b4) + countBits(b5) + countBits(b6) + countBits(b7);
+  }
+  
+  // The data of a pattern in PROGMEM, also checking that it has as many pixels set as its name promises.
+  template<uint8_t setBits, uint8_t b0, uint8_t b1, uint8_t b2, uint8_t b3, uint8_t b4, uint8_t b5, uint8_t b6, uint8_t b7>
+  static const uint8_t *pattern() {
+    static_assert(countBits(b0, b1, b2, b3, b4, b5, b6, b7) == setBits, "Unexpected density of the pattern");
+    static const uint8_t PROGMEM _data[] = { b0, b1, b2, b3, b4, b5, b6, b7 };
+    return _data;
+  }
+  
+  // The start and the length of the span between a and b (both included) without the part below 0, 
+  // so the length fits the line helpers even for spans like -128..127. False, if nothing is left.
+  static inline bool clipSpan(int8_t a, int8_t b, int16_t& start, int16_t& length) {
+    start = a < b ? a : b;
+    length = abs(b - a) + 1;
+    if (start < 0) {
+      length += start;
+      start = 0;
+    }
+    return length > 0;
+  }
+  
+  template<bool progmem>
+  static inline uint8_t readByte(const uint8_t *p) {
+    return progmem ? pgm_read_byte(p) : *p;
+  }
+  
+  /** Combines the bits of `s` with the ones of `d` according to the op, but only where the mask `m` is set. */
+  static inline uint8_t combine(uint8_t d, uint8_t s, uint8_t m, DrawingOp op) __attribute__((always_inline)) {
+    switch (op) {
+      case DrawingOpOr:
+        return d | (s & m);
+      case DrawingOpAnd:
+        return d & (s | ~m);
+      case DrawingOpXor:
+        return d ^ (s & m);
+      default:
+        return (d & ~m) | (s & m);
+    }
+  }
+  
+  template<bool progmem>
+  void blitInternal(int8_t x, int8_t y, const uint8_t *bitmap, DrawingOp op) {
+    
+    int16_t yy = (int16_t)y - _translationY;
+    
+    uint8_t width = readByte<progmem>(bitmap);
+    uint8_t height = readByte<progmem>(bitmap + 1);
+    const uint8_t *pixels = bitmap + 2;
+        
+    if (width == 0 || height == 0 || x + width <= 0 || x >= Width || yy + height <= 0 || yy >= Height) {
+      return;
+    }
+    
+    // The visible columns of the bitmap.
+    uint8_t first_col = x < 0 ? -x : 0;
+    uint8_t end_col = (x + width > Width) ? Width - x : width;
+    
+    // Every page of the bitmap covers either a single page of the framebuffer (when aligned) or two pages.
+    uint8_t shift = yy & 7;
+    int8_t page = yy >> 3;
+    
+    uint8_t pages = (height + 7) >> 3;
+    for (uint8_t src_page = 0; src_page < pages; src_page++, page++) {
+      
+      if (page >= Rows)
+        break;
+      
+      // The bits of the last page below the bitmap are not drawn.
+      uint8_t left = height - src_page * 8;
+      uint8_t mask = left >= 8 ? 0xFF : (1 << left) - 1;
+      
+      const uint8_t *src = pixels + src_page * width + first_col;
+      
+      if (shift == 0) {
+        
+        if (page < 0)
+          continue;
+        
+        uint8_t *dst = data + page * Cols + x + first_col;
+        for (uint8_t c = first_col; c < end_col; c++) {
+          *dst = combine(*dst, readByte<progmem>(src++), mask, op);
+          dst++;
+        }
+        
+      } else {
+        
+        uint8_t mask_top = mask << shift;
+        uint8_t mask_bottom = mask >> (8 - shift);
+        
+        bool top = page >= 0;
+        bool bottom = page + 1 >= 0 && page + 1 < Rows && mask_bottom != 0;
+        if (!top && !bottom)
+          continue;
+        
+        uint8_t *dst = data + (page + 1) * Cols + x + first_col;
+        for (uint8_t c = first_col; c < end_col; c++) {
+          uint8_t b = readByte<progmem>(src++);
+          if (top) {
+            *(dst - Cols) = combine(*(dst - Cols), b << shift, mask_top, op);
+          }
+          if (bottom) {
+            *dst = combine(*dst, b >> (8 - shift), mask_bottom, op);
+          }
+          dst++;
+        }
+      }
+    }
+  }
+  
   /** This is used to shift all the drawing operations with "tile-based" rendering. */
   void setTranslation(int8_t rows) {
     _translationY = rows * 8;
@@ -43,40 +204,123 @@ public:
   uint8_t data[Cols * Rows];
         
   /** Tile based rendering: the given drawing routine is called multiple times to render a part of the whole picture
-   * matching dimensions of the framebuffer; after drawing of each tile the framebuffer is flushed to the display. */
+   * matching dimensions of the framebuffer; after drawing of each tile the framebuffer is flushed to the display 
+   * via writePages() when available, which is a single transfer per tile on PCD8544 and SSD1306. */
   void draw(void (*draw)(Framebuffer& fb)) {
 
     uint8_t row;
-    for (row = 0; row + Rows <= _display::Rows; row += Rows) {      
+    for (row = 0; row + Rows <= Output::Pages; row += Rows) {      
       setTranslation(row);
       draw(*this);
-      _display::writeRow(0, row, data, sizeof(data));
+      Output::write(row, Rows, Cols, data);
     }
     
-    if (row < _display::Rows) {
+    if (row < Output::Pages) {
       setTranslation(row);
       draw(*this);
-      _display::writeRow(0, row, data, (_display::Rows - row) * Cols);
+      Output::write(row, Output::Pages - row, Cols, data);
     }
   }
   
-  void blit(int8_t x, int8_t y, const uint8_t *bitmap) {
+  /** @{ */
+  /** 
+   * Draws a bitmap with its top left corner at the given point, clipping it as needed. 
+   * The first two bytes of the bitmap are its width and height in pixels, followed by the pixels in the same 
+   * page layout as the framebuffer itself: `width` bytes for the top 8 lines, then `width` bytes for the next 8, etc. 
+   * The bits below the height of the bitmap in its last page are ignored.
+   */
+  
+  void blit(int8_t x, int8_t y, const uint8_t *bitmap, DrawingOp op = DrawingOpOr) {
+    blitInternal<false>(x, y, bitmap, op);
+  }
+  
+  /** Same as blit() but for bitmaps in the flash memory (PROGMEM). */
+  void blit_P(int8_t x, int8_t y, const uint8_t *bitmap, DrawingOp op = DrawingOpOr) {
+    blitInternal<true>(x, y, bitmap, op);
+  }
+  
+  /** @} */
+  
+  /** 
+   * Draws a line between two points (both included), clipping it as needed. 
+   * Exactly horizontal and vertical lines are handled by drawHorizontalLine() and drawVerticalLine().
+   */
+  void line(int8_t x1, int8_t y1, int8_t x2, int8_t y2, uint8_t color) {
     
-    int8_t yy = y - _translationY;
+    if (y1 == y2) {
+      int16_t start, length;
+      if (clipSpan(x1, x2, start, length))
+        drawHorizontalLine(start, y1, length, color);
+      return;
+    }
     
-    const uint8_t *src = bitmap;
-    uint8_t width = *src++;
-    uint8_t height = *src++;
-        
-    if (x + width <= 0 || x >= Width || yy + height <= 0 || yy >= Height) {
+    if (x1 == x2) {
+      int16_t start, length;
+      if (clipSpan(y1, y2, start, length))
+        drawVerticalLine(x1, start, length, color);
       return;
     }
     
-    // TODO: unfinished
-  }
-  
-  void line(int8_t x1, int8_t y1, int8_t x2, int8_t y2, uint8_t color) {
-    // TODO: unfinished
+    int16_t x = x1;
+    int16_t y = (int16_t)y1 - _translationY;
+    int16_t end_x = x2;
+    int16_t end_y = (int16_t)y2 - _translationY;
+    
+    // Both ends on the same side outside of the framebuffer?
+    if ((x < 0 && end_x < 0) || (x >= Width && end_x >= Width) || (y < 0 && end_y < 0) || (y >= Height && end_y >= Height))
+      return;
+    
+    // Bresenham's, but tracking the offset of the current byte and the mask of the bit within it as well, 
+    // so the address is not calculated for every pixel.
+    int16_t dx = abs(end_x - x);
+    int16_t dy = -abs(end_y - y);
+    int8_t step_x = x < end_x ? 1 : -1;
+    bool down = y < end_y;
+    int16_t err = dx + dy;
+    
+    int16_t offset = (y >> 3) * Cols + x;
+    uint8_t mask = 1 << (y & 7);
+    
+    while (true) {
+      
+      if (0 <= x && x < Width && 0 <= y && y < Height) {
+        if (color) {
+          data[offset] |= mask;
+        } else {
+          data[offset] &= ~mask;
+        }
+      }
+      
+      if (x == end_x && y == end_y)
+        break;
+      
+      int16_t e2 = 2 * err;
+      
+      if (e2 >= dy) {
+        err += dy;
+        x += step_x;
+        offset += step_x;
+      }
+      
+      if (e2 <= dx) {
+        err += dx;
+        if (down) {
+          y++;
+          mask <<= 1;
+          if (mask == 0) {
+            mask = 1;
+            offset += Cols;
+          }
+        } else {
+          y--;
+          mask >>= 1;
+          if (mask == 0) {
+            mask = 0x80;
+            offset -= Cols;
+          }
+        }
+      }
+    }
   }
   
   /** Fills the framebuffer with a specified color. */
@@ -97,79 +341,126 @@ public:
     drawVerticalLine(x + width - 1, y, height, color);
   }
   
-  /** Draws a vertical line beginning at the given point and having the length specified. 
-   * This should be faster than a generic line drawing routine. 
-   * It can be made even faster by setting 8 bits at a time, but the code would become larger. */
-  void drawVerticalLine(int8_t x, int8_t y, uint8_t length, uint8_t color) {
-    
-    if (x < 0 || x >= Width)
-      return;
+  /** @{ */
+  /** 
+   * 8x8 patterns for fillRect() in the flash memory (PROGMEM). Every byte is a column of 8 pixels, 
+   * the pattern repeats every 8 columns and every page, so the neighbouring fills match.
+   */
+  
+  static const uint8_t *patternSolid() {
+    return pattern<64, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF>();
+  }
+  
+  static const uint8_t *patternEmpty() {
+    return pattern<0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00>();
+  }
+  
+  /** Checkerboard, every second pixel is set. */
+  static const uint8_t *patternDither50() {
+    return pattern<32, 0x55, 0xAA, 0x55, 0xAA, 0x55, 0xAA, 0x55, 0xAA>();
+  }
+  
+  /** Every fourth pixel is set. */
+  static const uint8_t *patternDither25() {
+    return pattern<16, 0x11, 0x44, 0x11, 0x44, 0x11, 0x44, 0x11, 0x44>();
+  }
+  
+  /** Every fourth pixel is cleared, the inverse of patternDither25(). */
+  static const uint8_t *patternDither75() {
+    return pattern<48, 0xEE, 0xBB, 0xEE, 0xBB, 0xEE, 0xBB, 0xEE, 0xBB>();
+  }
+  
+  /** @} */
+  
+  /** 
+   * Fills a rectangle with the top left corner at the given point with a pattern (see patternSolid() and friends) 
+   * combined with the existing pixels according to the op, clipping it as needed. 
+   * Whole bytes are processed at a time: the partially covered pages are masked, the fully covered ones 
+   * are simply stored, or memset if the pattern allows.
+   */
+  void fillRect(int8_t x, int8_t y, uint8_t width, uint8_t height, const uint8_t *pattern, DrawingOp op = DrawingOpCopy) {
     
-    int8_t yy1 = y - _translationY;
-    int8_t yy2 = yy1 + length - 1;
+    int16_t x1 = x;
+    int16_t x2 = x1 + width - 1;
+    int16_t yy1 = (int16_t)y - _translationY;
+    int16_t yy2 = yy1 + height - 1;
     
-    if (yy2 < 0 || yy1 >= Height)
+    if (width == 0 || height == 0 || x2 < 0 || x1 >= Width || yy2 < 0 || yy1 >= Height)
       return;
     
+    if (x1 < 0)
+      x1 = 0;
+    if (x2 > Width - 1)
+      x2 = Width - 1;
     if (yy1 < 0)
       yy1 = 0;
     if (yy2 > Height - 1)
       yy2 = Height - 1;
     
-    uint8_t *dst = data + (yy1 >> 3) * Cols + x;
-    uint8_t mask = 1 << (yy1 & 7);
+    uint8_t cols = x2 - x1 + 1;
     
-    if (color) {
-      for (uint8_t yy = yy1; yy <= yy2;) {
-        do {
-          *dst |= mask;
-          mask <<= 1;
-          yy++;
-        } while (mask != 0 && yy <= yy2);
-        dst += Cols;
-        mask = 1;
+    // The pattern is aligned with the absolute columns, so it's easier to copy it into RAM rotated accordingly.
+    uint8_t p[8];
+    for (uint8_t i = 0; i < 8; i++) {
+      p[i] = pgm_read_byte(pattern + ((x1 + i) & 7));
+    }
+    
+    // When the pattern is the same for every column, then the full pages can be memset in some cases.
+    bool uniform = true;
+    for (uint8_t i = 1; i < 8; i++) {
+      if (p[i] != p[0]) {
+        uniform = false;
+        break;
       }
-    } else {
-      mask = ~mask;
-      for (uint8_t yy = yy1; yy <= yy2; y++) {
-        *dst &= mask;
-        dst += Cols;
-        mask = (mask == 0x7F) ? 0xFE : (mask << 1) | 1;
+    }
+    int16_t fill_value = -1;
+    if (uniform) {
+      if (op == DrawingOpCopy) {
+        fill_value = p[0];
+      } else if (op == DrawingOpOr && p[0] == 0xFF) {
+        fill_value = 0xFF;
+      } else if (op == DrawingOpAnd && p[0] == 0x00) {
+        fill_value = 0x00;
       }
     }
-  }
-  
-  /** Draws a horizontal line beginning at the given point and having the specified length.
-   * This should be faster than a generic line drawing routine. */
-  void drawHorizontalLine(int8_t x, int8_t y, uint8_t length, uint8_t color) {
-    
-    int8_t yy = y - _translationY;
-      
-    if (yy < 0 || yy >= Height)
-      return;
     
-    int8_t xx1 = x;
-    int8_t xx2 = x + length - 1;        
-    if (xx2 < 0 || xx1 >= Width)
-      return;
-    
-    if (xx1 < 0)
-      xx1 = 0;
-    if (xx2 > Width - 1)
-      xx2 = Width - 1;
-    
-    uint8_t *dst = data + (yy >> 3) * Cols + xx1;
-    uint8_t mask = 1 << (y & 7);
+    uint8_t first_page = yy1 >> 3;
+    uint8_t last_page = yy2 >> 3;
+    uint8_t head_mask = 0xFF << (yy1 & 7);
+    uint8_t tail_mask = 0xFF >> (7 - (yy2 & 7));
     
-    if (color) {
-      for (uint8_t xx = xx1; xx <= xx2; xx++) {
-        *dst++ |= mask;
-      }
-    } else {
-      mask = ~mask;
-      for (uint8_t xx = xx1; xx <= xx2; xx++) {
-        *dst++ &= mask;
+    uint8_t *dst = data + first_page * Cols + x1;
+    for (uint8_t page = first_page; page <= last_page; page++, dst += Cols) {
+      
+      uint8_t mask = 0xFF;
+      if (page == first_page)
+        mask &= head_mask;
+      if (page == last_page)
+        mask &= tail_mask;
+      
+      if (mask == 0xFF && fill_value >= 0) {
+        memset(dst, fill_value, cols);
+      } else {
+        uint8_t *d = dst;
+        for (uint8_t c = 0; c < cols; c++, d++) {
+          *d = combine(*d, p[c & 7], mask, op);
+        }
       }
     }
   }
+  
+  /** Inverts the pixels of the rectangle. */
+  void invertRect(int8_t x, int8_t y, uint8_t width, uint8_t height) {
+    fillRect(x, y, width, height, patternSolid(), DrawingOpXor);
+  }
+  
+  /** Draws a vertical line beginning at the given point and having the length specified. */
+  void drawVerticalLine(int8_t x, int8_t y, uint8_t length, uint8_t color) {
+    fillRect(x, y, 1, length, color ? patternSolid() : patternEmpty());
+  }
+  
+  /** Draws a horizontal line beginning at the given point and having the specified length. */
+  void drawHorizontalLine(int8_t x, int8_t y, uint8_t length, uint8_t color) {
+    fillRect(x, y, length, 1, color ? patternSolid() : patternEmpty());
+  }
 };
@@ -3,13 +3,30 @@
 // Copyright (C) 2016-2018, Aleh Dzenisiuk. http://github.com/aleh/a21
 //
 
+#pragma once
+
 #include <Arduino.h>
 
+#include <a21/pins.hpp>
+#include <a21/clock.hpp>
+
 namespace a21 {
 
 /** 
  * Basic software I2C. 
- * If builtInPullups is true, then the built-in pull-ups will be used with SCL and SDA pins.
+ * 
+ * If builtInPullups is true, then the built-in pull-ups will be used with SCL and SDA pins. Otherwise the lines 
+ * are driven as open-drain ones: the output levels are preset to LOW once and only the directions are changed, 
+ * so every edge is a single register write.
+ * 
+ * The timing of every bit is calculated at compile time from F_CPU and the frequency, taking into account 
+ * the cycles spent on the pin operations themselves. When the MCU is too slow to reach the requested frequency, 
+ * then the bus simply runs as fast as it can, see EffectiveFrequency. For example, at 16MHz the Standard (100kHz) 
+ * and Fast (400kHz) modes are reached, while requesting 1MHz results in about 727kHz with the built-in pull-ups 
+ * and about 889kHz in open-drain mode.
+ * 
+ * The `Clock` is used for the delays within the bits: its delayCycles<cycles>() when it has one (see ArduinoClock), 
+ * otherwise delayMicroseconds(), which is less precise.
  */
 template<
   typename pinSCL, 
@@ -22,39 +39,123 @@ class SoftwareI2C {
 
 private:
   
-  static inline void ReleaseSCL() {
-    pinSCL::setInput(builtInPullups);
+  // Using the atomic versions of pin functions, so an interrupt handler changing other pins 
+  // of the same ports at the same time won't be affected.
+
+  static inline void ReleaseSCL() __attribute__((always_inline)) {
+    if (builtInPullups) {
+      pinSCL::setInputAtomic(true);
+    } else {
+      pinSCL::releaseAtomic();
+    }
   }
 
-  static inline void PullDownSCL() {
-    pinSCL::setLow();
-    pinSCL::setOutput();
+  static inline void PullDownSCL() __attribute__((always_inline)) {
+    if (builtInPullups) {
+      pinSCL::setLowAtomic();
+    }
+    pinSCL::setOutputAtomic();
   }  
   
-  static inline bool IsSCLHigh() {
+  static inline bool IsSCLHigh() __attribute__((always_inline)) {
     return pinSCL::read();
   }  
 
-  static inline void ReleaseSDA() {
-    pinSDA::setInput(builtInPullups);
+  static inline void ReleaseSDA() __attribute__((always_inline)) {
+    if (builtInPullups) {
+      pinSDA::setInputAtomic(true);
+    } else {
+      pinSDA::releaseAtomic();
+    }
   }
 
-  static inline void PullDownSDA() {
-    pinSDA::setLow();
-    pinSDA::setOutput();
+  static inline void PullDownSDA() __attribute__((always_inline)) {
+    if (builtInPullups) {
+      pinSDA::setLowAtomic();
+    }
+    pinSDA::setOutputAtomic();
   }
   
-  static inline bool IsSDAHigh() {
+  static inline bool IsSDAHigh() __attribute__((always_inline)) {
     return pinSDA::read();
   }
   
-  static inline void delay(uint8_t t) __attribute__((always_inline)) {
-    Clock::delayMicroseconds(t * 1000000L / frequency);
+  //
+  // Timing. All values are in CPU cycles.
+  //
+  
+  static constexpr uint32_t max(uint32_t a, uint32_t b) { return a > b ? a : b; }
+  static constexpr uint32_t cycles(double us) { return (uint32_t)(us * (F_CPU / 1000000.0) + 0.5); }
+  
+  // Approximate costs of the operations on the lower I/O ports (sbi/cbi/sbis are 2 cycles each), 
+  // a release or a pull down is one such operation in open-drain mode and two with the built-in pull-ups.
+  static const uint32_t LineCycles = builtInPullups ? 4 : 2;
+  static const uint32_t ReadCycles = 2;
+  static const uint32_t BranchCycles = 2;
+  static const uint32_t LoopCycles = 4;
+  
+  static const uint32_t BitCycles = F_CPU / frequency;
+  
+  // Minimum LOW time of SCL for Standard, Fast and Fast Plus modes. The LOW part gets a bigger share of the period 
+  // when the half of it is not enough, e.g. 1.3us vs 1.2us at 400kHz.
+  static const uint32_t LowCycles = max(
+    BitCycles / 2, 
+    frequency <= 100000L ? cycles(4.7) : (frequency <= 400000L ? cycles(1.3) : cycles(0.5))
+  );
+  static const uint32_t HighCycles = BitCycles > LowCycles ? BitCycles - LowCycles : 0;
+  
+  // What the bit loop spends anyway while SCL is LOW (setting SDA, releasing SCL) and while it is HIGH 
+  // (checking SCL, looping, pulling SCL down).
+  static const uint32_t LowOverheadCycles = BranchCycles + LineCycles + LineCycles;
+  static const uint32_t HighOverheadCycles = ReadCycles + BranchCycles + LoopCycles + LineCycles;
+  
+  static const uint32_t LowDelayCycles = LowCycles > LowOverheadCycles ? LowCycles - LowOverheadCycles : 0;
+  static const uint32_t HighDelayCycles = HighCycles > HighOverheadCycles ? HighCycles - HighOverheadCycles : 0;
+  
+  // Clocks without delayCycles() (the ones written before it was added to ArduinoClock) are still supported.
+  template<uint32_t cycles, typename clock = Clock, typename = void>
+  class Delay {
+  public:
+    static inline void wait() {
+      if (cycles > 0) {
+        clock::delayMicroseconds(cycles * 1000000.0 / F_CPU);
+      }
+    }
+  };
+  
+  template<uint32_t cycles, typename clock>
+  class Delay<cycles, clock, decltype(clock::template delayCycles<cycles>())> {
+  public:
+    static inline void wait() {
+      clock::template delayCycles<cycles>();
+    }
+  };
+  
+  static inline void delayLow() __attribute__((always_inline)) {
+    Delay<LowDelayCycles>::wait();
+  }
+  
+  static inline void delayHigh() __attribute__((always_inline)) {
+    Delay<HighDelayCycles>::wait();
   }
   
 public:
   
+  /** 
+   * The SCL frequency the data bits are actually clocked at, which is lower than the requested one 
+   * when F_CPU is not high enough for it. Note that the start/stop conditions and the ACK bits are not included. 
+   */
+  static const uint32_t EffectiveFrequency = 
+    F_CPU / (max(LowCycles, LowOverheadCycles) + max(HighCycles, HighOverheadCycles));
+  
   static void begin() {
+    if (!builtInPullups) {
+      // Open-drain mode, making sure the lines are pulled down when they are outputs.
+      pinSCL::release();
+      pinSCL::setLow();
+      pinSDA::release();
+      pinSDA::setLow();
+    }
     ReleaseSCL();
     ReleaseSDA();
   }  
@@ -63,30 +164,51 @@ public:
     
     // Assuming SCL is released, so pulling down SDA to indicate the start condition.
     PullDownSDA();
-    delay(1);
+    delayHigh();
     
     return write(slave_address << 1);
   }
   
+  /** Sends the start condition followed by the address of the slave in read mode, returns true if it has ACK'ed it. */
+  static bool startReading(uint8_t slave_address) {
+    
+    PullDownSDA();
+    delayHigh();
+    
+    return write((slave_address << 1) | 1);
+  }
+  
+  /** 
+   * Should be called after writing or reading instead of stop() when the next transaction needs to begin without 
+   * releasing the bus, e.g. when reading from a register of a device. The following startWriting() or startReading() 
+   * will then generate a repeated start condition. 
+   */
+  static void repeatedStart() {
+    PullDownSCL();
+    ReleaseSDA();
+    delayLow();
+    ReleaseSCL();
+    delayHigh();
+  }
+  
   static bool write(uint8_t b) {
     
     for (uint8_t bit = 8; bit != 0; bit--, b <<= 1) {
       
       PullDownSCL();
       
-      delay(0.1);
-      
+      // No need to wait before changing SDA, the data hold time is 0 for the master.
       if (b & 0x80) {
         ReleaseSDA();
       } else {
         PullDownSDA();
       }
       
-      delay(0.4);
-              
+      delayLow();
+      
       ReleaseSCL();
       
-      delay(0.5);
+      delayHigh();
       
       // We don't support clock stretching.
       if (!IsSCLHigh())
@@ -96,31 +218,73 @@ public:
     // Acknowledge bit.
     PullDownSCL();
     ReleaseSDA();
-    delay(0.5);
+    delayLow();
     ReleaseSCL();
-    delay(0.5);
+    delayHigh();
     
     return !IsSDAHigh();
   }
   
+  /** 
+   * Reads a single byte from the slave (after startReading()) acknowledging it if `ack` is true. 
+   * The last byte of every read transaction should not be acknowledged.
+   */
+  static uint8_t read(bool ack) {
+    
+    uint8_t result = 0;
+    
+    for (uint8_t bit = 8; bit != 0; bit--) {
+      
+      PullDownSCL();
+      
+      // The SDA could be pulled down by our ACK of the previous byte.
+      ReleaseSDA();
+      
+      delayLow();
+      
+      ReleaseSCL();
+      
+      delayHigh();
+      
+      // Clock stretching is not supported here either.
+      result <<= 1;
+      if (IsSDAHigh()) {
+        result |= 1;
+      }
+    }
+    
+    // Acknowledge bit.
+    PullDownSCL();
+    if (ack) {
+      PullDownSDA();
+    }
+    delayLow();
+    ReleaseSCL();
+    delayHigh();
+    
+    return result;
+  }
+  
   static inline void stop() {
     PullDownSCL();
-    delay(0.5);
     PullDownSDA();
+    delayLow();
     ReleaseSCL();
-    delay(1);
-    ReleaseSDA();    
+    delayHigh();
+    ReleaseSDA();
+    // The bus free time before the next start condition is the same as the minimum LOW time of SCL.
+    delayLow();
   }
   
-  static bool write(const uint8_t *data, uint8_t data_length) {
-    for (uint8_t i = 0; i < data_length; i++) {
+  static bool write(const uint8_t *data, uint16_t data_length) {
+    for (uint16_t i = 0; i < data_length; i++) {
       if (!write(data[i]))
         return false;
     }
     return true;
   }
       
-  static bool write(uint8_t slave_address, const uint8_t *data, uint8_t data_length) {
+  static bool write(uint8_t slave_address, const uint8_t *data, uint16_t data_length) {
     
     bool result = startWriting(slave_address) && write(data, data_length);
         
@@ -129,6 +293,595 @@ public:
     return result;
   }
   
+  /** Reads `data_length` bytes acknowledging all of them except the last one. */
+  static void read(uint8_t *data, uint16_t data_length) {
+    for (uint16_t i = data_length; i > 0; i--) {
+      *data++ = read(i > 1);
+    }
+  }
 };  
   
-};
\ No newline at end of file
+#if defined(TWCR)
+
+/**
+ * I2C master using the TWI module of ATmega MCUs. Has the same interface as SoftwareI2C above, so the drivers
+ * can use either. 
+ * 
+ * The bus frequency can be anything from about F_CPU / (16 + 2 * 255 * 64) up to F_CPU / 16, e.g. 100kHz, 400kHz 
+ * or 1MHz (Fast-mode Plus, needs F_CPU of 16MHz or more and the devices supporting it). 
+ * SCL and SDA pins are fixed by the hardware; if builtInPullups is true, then their internal pull-ups are enabled, 
+ * which is OK for short wires and lower frequencies only.
+ * 
+ * Each byte is still waited for, but the module handles all the bits, clock stretching and the timing itself.
+ */
+template<
+  uint32_t frequency = 400000L,
+  bool builtInPullups = true
+>
+class HardwareI2C {
+
+private:
+
+  // SCL frequency = F_CPU / (16 + 2 * TWBR * 4^TWPS), so first trying to fit TWBR with the smallest prescaler.
+  static constexpr uint32_t bitRate(uint8_t prescalerBits) {
+    return (F_CPU / frequency - 16) / (2UL << (2 * prescalerBits));
+  }
+  
+  static const uint8_t prescalerBits = bitRate(0) <= 255 ? 0 : (bitRate(1) <= 255 ? 1 : (bitRate(2) <= 255 ? 2 : 3));
+  
+  static_assert(F_CPU / frequency >= 16, "The TWI cannot run at this frequency with this F_CPU, it can do F_CPU / 16 max");
+  static_assert(bitRate(3) <= 255, "The TWI cannot run at this frequency with this F_CPU, it is too low");
+  
+  // Status codes, see TWSR in the datasheet.
+  enum : uint8_t {
+    StatusStart = 0x08,
+    StatusRepeatedStart = 0x10,
+    StatusAddressWriteAck = 0x18,
+    StatusDataWriteAck = 0x28,
+    StatusAddressReadAck = 0x40
+  };
+  
+  /** Starts the next action of the module and waits for it to complete, returning the status. */
+  static inline uint8_t perform(uint8_t flags) __attribute__((always_inline)) {
+    TWCR = _BV(TWINT) | _BV(TWEN) | flags;
+    while (!(TWCR & _BV(TWINT)))
+      ;
+    return TWSR & 0xF8;
+  }
+  
+public:
+  
+  static void begin() {
+    
+    FastPin<SDA>::setInput(builtInPullups);
+    FastPin<SCL>::setInput(builtInPullups);
+    
+    TWSR = prescalerBits;
+    TWBR = bitRate(prescalerBits);
+    TWCR = _BV(TWEN);
+  }
+  
+  static bool startWriting(uint8_t slave_address) {
+    
+    uint8_t status = perform(_BV(TWSTA));
+    if (status != StatusStart && status != StatusRepeatedStart)
+      return false;
+    
+    TWDR = slave_address << 1;
+    return perform(0) == StatusAddressWriteAck;
+  }
+  
+  static bool startReading(uint8_t slave_address) {
+    
+    uint8_t status = perform(_BV(TWSTA));
+    if (status != StatusStart && status != StatusRepeatedStart)
+      return false;
+    
+    TWDR = (slave_address << 1) | 1;
+    return perform(0) == StatusAddressReadAck;
+  }
+  
+  /** Nothing to prepare here: the module generates a repeated start if we still own the bus. */
+  static inline void repeatedStart() {
+  }
+  
+  static bool write(uint8_t b) {
+    TWDR = b;
+    return perform(0) == StatusDataWriteAck;
+  }
+  
+  static uint8_t read(bool ack) {
+    perform(ack ? _BV(TWEA) : 0);
+    return TWDR;
+  }
+  
+  static inline void stop() {
+    
+    // TWINT is not set after the stop condition, but TWSTO is cleared once it's done.
+    TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTO);
+    while (TWCR & _BV(TWSTO))
+      ;
+  }
+  
+  static bool write(const uint8_t *data, uint16_t data_length) {
+    for (uint16_t i = 0; i < data_length; i++) {
+      if (!write(data[i]))
+        return false;
+    }
+    return true;
+  }
+  
+  static bool write(uint8_t slave_address, const uint8_t *data, uint16_t data_length) {
+    
+    bool result = startWriting(slave_address) && write(data, data_length);
+    
+    stop();
+    
+    return result;
+  }
+  
+  /** Reads `data_length` bytes acknowledging all of them except the last one. */
+  static void read(uint8_t *data, uint16_t data_length) {
+    for (uint16_t i = data_length; i > 0; i--) {
+      *data++ = read(i > 1);
+    }
+  }
+};
+
+/**
+ * Interrupt-driven I2C master using the TWI module. Transactions are queued and performed back-to-back 
+ * in the background, so the caller does not wait for the bus unless the queue is full.
+ * 
+ * There are two ways to queue a transaction:
+ * 
+ * - submit() queues a descriptor: the address of the slave, an optional prefix byte (e.g. 0x40 or 0x00 telling 
+ *   SSD1306 if data or commands follow) and a pointer to the data, which is not copied and thus must stay intact 
+ *   till the transaction completes;
+ * 
+ * - startWriting()/write()/stop() work like the ones of SoftwareI2C and HardwareI2C, so this class can be passed 
+ *   to the drivers (like SSD1306) instead of them. The bytes are copied into an internal buffer and the bus is held 
+ *   (SCL is stretched) while the transaction is open and the buffer is empty.
+ * 
+ * Every transaction gets an ID and the completion handler is called with it from the interrupt handler, 
+ * telling if all the bytes were acknowledged. The functions of the second group always return true except 
+ * for write() after the slave has NACK'ed the transaction in the background, so the drivers relying 
+ * on the immediate result (like SSD1306::begin() waiting for the display) should be used with the synchronous 
+ * versions or after flush(). Reading is not supported.
+ * 
+ * As with AsyncSPI the interrupt handler has to be defined in the sketch:
+ * \code
+ * typedef AsyncI2C<> I2C;
+ * typedef SSD1306<I2C> LCD;
+ * 
+ * ISR(TWI_vect) {
+ *   I2C::handleInterrupt();
+ * }
+ * \endcode
+ */
+template<
+  uint32_t frequency = 400000L,
+  bool builtInPullups = true,
+  uint8_t queueSize = 8,
+  uint8_t bufferSize = 64
+>
+class AsyncI2C {
+  
+public:
+  
+  /** Called from the interrupt handler when a transaction is complete. */
+  typedef void (*CompletionHandler)(uint8_t id, bool acked);
+  
+private:
+  
+  typedef AsyncI2C<frequency, builtInPullups, queueSize, bufferSize> Self;
+  
+  enum TransactionFlags : uint8_t {
+    // The prefix byte is not sent yet.
+    FlagPrefix = 1,
+    // The data is in the flash memory.
+    FlagProgmem = 2,
+    // The data is in the internal buffer rather than pointed by `data`.
+    FlagBuffered = 4,
+    // Opened by startWriting() and not closed by stop() yet, so more bytes can be added.
+    FlagOpen = 8,
+    // NACK'ed or lost the bus while still open.
+    FlagFailed = 16
+  };
+  
+  struct Transaction {
+    uint8_t id;
+    uint8_t address;
+    uint8_t prefix;
+    volatile uint8_t flags;
+    const uint8_t *data;
+    volatile uint16_t length;
+  };
+  
+  Transaction _queue[queueSize];
+  volatile uint8_t _head;
+  volatile uint8_t _tail;
+  
+  uint8_t _buffer[bufferSize];
+  volatile uint8_t _bufferHead;
+  volatile uint8_t _bufferTail;
+  
+  // The index of the transaction opened by startWriting().
+  uint8_t _open;
+  
+  uint8_t _lastID;
+  volatile bool _busy;
+  // True, if the interrupt is disabled because the current transaction is open but has no bytes to send.
+  volatile bool _stalled;
+  volatile bool _inCompletionHandler;
+  CompletionHandler volatile _completionHandler;
+  
+  static Self& getSelf() {
+    static Self self;
+    return self;
+  }
+  
+  static inline uint8_t nextIndex(uint8_t i) {
+    return (i + 1 == queueSize) ? 0 : i + 1;
+  }
+  
+  static inline uint8_t nextBufferIndex(uint8_t i) {
+    return (i + 1 == bufferSize) ? 0 : i + 1;
+  }
+  
+  // Clears TWINT, i.e. lets the module perform the next action, and keeps the interrupt enabled.
+  static const uint8_t Go = _BV(TWINT) | _BV(TWEN) | _BV(TWIE);
+  
+  // All the functions below are called with interrupts disabled.
+  
+  static void startNext(bool stopFirst) {
+    
+    Self& self = getSelf();
+    
+    if (self._head != self._tail) {
+      if (!stopFirst) {
+        // The stop condition of the previous transaction could be still in progress.
+        while (TWCR & _BV(TWSTO))
+          ;
+      }
+      // When both are set the module generates a stop condition followed by a start one.
+      TWCR = Go | _BV(TWSTA) | (stopFirst ? _BV(TWSTO) : 0);
+    } else {
+      if (stopFirst) {
+        TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTO);
+      }
+      self._busy = false;
+    }
+  }
+  
+  // Drops the bytes of the current transaction that are not sent yet.
+  static void discardRemaining(Transaction& t) {
+    Self& self = getSelf();
+    if (t.flags & FlagBuffered) {
+      for (uint16_t i = t.length; i > 0; i--) {
+        self._bufferHead = nextBufferIndex(self._bufferHead);
+      }
+    }
+    t.length = 0;
+  }
+  
+  static void complete(bool acked, bool stopFirst) {
+    
+    Self& self = getSelf();
+    
+    Transaction& t = self._queue[self._head];
+    discardRemaining(t);
+    uint8_t id = t.id;
+    
+    self._head = nextIndex(self._head);
+    startNext(stopFirst);
+    
+    if (self._completionHandler) {
+      self._inCompletionHandler = true;
+      self._completionHandler(id, acked);
+      self._inCompletionHandler = false;
+    }
+  }
+  
+  static void fail() {
+    
+    Self& self = getSelf();
+    
+    Transaction& t = self._queue[self._head];
+    if (t.flags & FlagOpen) {
+      // Cannot complete it yet, more bytes can be queued till stop() is called. Releasing the bus for now.
+      discardRemaining(t);
+      t.flags |= FlagFailed;
+      TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTO);
+    } else {
+      complete(false, true);
+    }
+  }
+  
+  static void sendNext() {
+    
+    Self& self = getSelf();
+    
+    Transaction& t = self._queue[self._head];
+    
+    if (t.flags & FlagPrefix) {
+      t.flags &= ~FlagPrefix;
+      TWDR = t.prefix;
+      TWCR = Go;
+    } else if (t.length > 0) {
+      t.length--;
+      if (t.flags & FlagBuffered) {
+        TWDR = self._buffer[self._bufferHead];
+        self._bufferHead = nextBufferIndex(self._bufferHead);
+      } else if (t.flags & FlagProgmem) {
+        TWDR = pgm_read_byte(t.data++);
+      } else {
+        TWDR = *t.data++;
+      }
+      TWCR = Go;
+    } else if (t.flags & FlagOpen) {
+      // Waiting for more bytes or stop(). Leaving TWINT set holds the bus, but have to disable the interrupt.
+      self._stalled = true;
+      TWCR = _BV(TWEN);
+    } else {
+      complete(true, true);
+    }
+  }
+  
+  static void resume() {
+    Self& self = getSelf();
+    if (self._stalled) {
+      self._stalled = false;
+      // Not writing TWINT here, so the pending interrupt fires as soon as it is enabled.
+      TWCR = _BV(TWEN) | _BV(TWIE);
+    }
+  }
+  
+  // Waits for a free slot in the queue and fills it in, returning the ID of the new transaction. 
+  // Nobody can free a slot while we are in the completion handler, so 0 is returned then instead of waiting.
+  static uint8_t submit(uint8_t address, uint8_t prefix, const uint8_t *data, uint16_t length, uint8_t flags) {
+    
+    Self& self = getSelf();
+    
+    for (;;) {
+      
+      {
+        // The completion handler can submit as well, so the slot is taken and filled in with interrupts disabled.
+        InterruptLock lock;
+        
+        uint8_t tail = nextIndex(self._tail);
+        if (tail != self._head) {
+          
+          Transaction& t = self._queue[self._tail];
+          t.address = address;
+          t.prefix = prefix;
+          t.flags = flags;
+          t.data = data;
+          t.length = length;
+          
+          // 0 is never used, so it can be returned when the transaction cannot be queued.
+          if (++self._lastID == 0)
+            self._lastID = 1;
+          t.id = self._lastID;
+          
+          if (flags & FlagOpen)
+            self._open = self._tail;
+          
+          self._tail = tail;
+          if (!self._busy) {
+            self._busy = true;
+            startNext(false);
+          }
+          
+          return t.id;
+        }
+      }
+      
+      if (self._inCompletionHandler)
+        return 0;
+    }
+  }
+  
+public:
+  
+  /** Configures the TWI module and the pins, see HardwareI2C. */
+  static void begin() {
+    HardwareI2C<frequency, builtInPullups>::begin();
+  }
+  
+  /** Should be called from the TWI interrupt handler (TWI_vect). */
+  static void handleInterrupt() {
+    
+    switch (TWSR & 0xF8) {
+      
+      case 0x08: // Start.
+      case 0x10: // Repeated start.
+        TWDR = getSelf()._queue[getSelf()._head].address << 1;
+        TWCR = Go;
+        break;
+        
+      case 0x18: // Address ACK'ed.
+      case 0x28: // Data ACK'ed.
+        sendNext();
+        break;
+        
+      default: // NACKs, arbitration lost or bus errors.
+        fail();
+        break;
+    }
+  }
+  
+  /** 
+   * Sets a function to be called from the interrupt handler every time a transaction completes. 
+   * It can queue more transactions, but only as many as there is free space for: the queues cannot be drained 
+   * while in the handler, so submit() returns 0, startWriting() and write() return false instead of waiting. 
+   */
+  static void setCompletionHandler(CompletionHandler handler) {
+    getSelf()._completionHandler = handler;
+  }
+  
+  /** True, if there are transactions in progress or waiting in the queue. */
+  static bool busy() {
+    return getSelf()._busy;
+  }
+  
+  /** Waits till all the transactions queued so far are complete. */
+  static void flush() {
+    while (busy())
+      ;
+  }
+  
+  /** @{ */
+  /** 
+   * Queues a transaction sending `length` bytes pointed by `data` (after `prefix`, if it's used) to the slave. 
+   * The data is not copied, so it should stay the same till the transaction is complete. 
+   * Returns the ID of the transaction that will be passed to the completion handler 
+   * or 0 if the queue was full when called from the completion handler. 
+   */
+  
+  static uint8_t submit(uint8_t address, const uint8_t *data, uint16_t length) {
+    return submit(address, 0, data, length, 0);
+  }
+  
+  static uint8_t submit(uint8_t address, uint8_t prefix, const uint8_t *data, uint16_t length) {
+    return submit(address, prefix, data, length, FlagPrefix);
+  }
+  
+  /** Same as above, but the data is in the flash memory (PROGMEM). */
+  static uint8_t submit_P(uint8_t address, uint8_t prefix, const uint8_t *data, uint16_t length) {
+    return submit(address, prefix, data, length, FlagPrefix | FlagProgmem);
+  }
+  
+  /** @} */
+  
+  /** @{ */
+  /** Same interface as the other I2C classes. */
+  
+  static bool startWriting(uint8_t slave_address) {
+    
+    return submit(slave_address, 0, NULL, 0, FlagBuffered | FlagOpen) != 0;
+  }
+  
+  static bool write(uint8_t b) {
+    
+    Self& self = getSelf();
+    
+    for (;;) {
+      
+      {
+        InterruptLock lock;
+        
+        Transaction& t = self._queue[self._open];
+        if (t.flags & FlagFailed)
+          return false;
+        
+        uint8_t tail = nextBufferIndex(self._bufferTail);
+        if (tail != self._bufferHead) {
+          
+          self._buffer[self._bufferTail] = b;
+          self._bufferTail = tail;
+          t.length++;
+          
+          resume();
+          
+          return true;
+        }
+      }
+      
+      // Waiting for the interrupt handler to free some space in the buffer (unless we are in it).
+      if (self._inCompletionHandler)
+        return false;
+    }
+  }
+  
+  static void stop() {
+    
+    Self& self = getSelf();
+    
+    InterruptLock lock;
+    
+    Transaction& t = self._queue[self._open];
+    t.flags &= ~FlagOpen;
+    if (t.flags & FlagFailed) {
+      // The bus has been released already, see fail().
+      complete(false, false);
+    } else {
+      resume();
+    }
+  }
+  
+  static bool write(const uint8_t *data, uint16_t data_length) {
+    for (uint16_t i = 0; i < data_length; i++) {
+      if (!write(data[i]))
+        return false;
+    }
+    return true;
+  }
+  
+  static bool write(uint8_t slave_address, const uint8_t *data, uint16_t data_length) {
+    
+    bool result = startWriting(slave_address) && write(data, data_length);
+    
+    stop();
+    
+    return result;
+  }
+  
+  /** @} */
+};
+
+#endif // TWCR
+
+/**
+ * Helper for the common kind of I2C slaves exposing a bunch of registers, where the register number is written 
+ * first and then the data is read or written with auto-increment of the register number. 
+ * Works with any of the I2C classes above.
+ */
+template<typename i2c, uint8_t address>
+class RegisterDevice {
+  
+public:
+  
+  /** 
+   * Reads `count` consecutive registers starting with `reg` within a single transaction (using a repeated start). 
+   * Returns false if the device has not acknowledged its address or the register number. 
+   */
+  static bool readRegisters(uint8_t reg, uint8_t *data, uint16_t count) {
+    
+    if (!(i2c::startWriting(address) && i2c::write(reg))) {
+      i2c::stop();
+      return false;
+    }
+    
+    i2c::repeatedStart();
+    
+    if (!i2c::startReading(address)) {
+      i2c::stop();
+      return false;
+    }
+    
+    i2c::read(data, count);
+    i2c::stop();
+    
+    return true;
+  }
+  
+  static bool readRegister(uint8_t reg, uint8_t& value) {
+    return readRegisters(reg, &value, 1);
+  }
+  
+  /** Writes `count` consecutive registers starting with `reg`. */
+  static bool writeRegisters(uint8_t reg, const uint8_t *data, uint16_t count) {
+    
+    bool result = i2c::startWriting(address) && i2c::write(reg) && i2c::write(data, count);
+    
+    i2c::stop();
+    
+    return result;
+  }
+  
+  static bool writeRegister(uint8_t reg, uint8_t value) {
+    return writeRegisters(reg, &value, 1);
+  }
+};
+
+} // namespace
@@ -7,9 +7,10 @@
 
 #include <Arduino.h>
 
-#include <a21/pcd8544fonts.hpp>
+#include <a21/font8.hpp>
+#include <a21/font8fonts.hpp>
+#include <a21/display8.hpp>
 #include <a21/spi.hpp>
-#include <a21/flashstring.hpp>
 
 namespace a21 {
   
@@ -17,12 +18,20 @@ namespace a21 {
  * Basic wrapper for a PCD8544 LCD display (such as the one that was used on Nokia 5110) using software SPI.
  * The parameters are FastPin-wrapped pins in the order they have on the actual device (well, at least on mine):
  * RST, CE, DC, DIN, CLK.
+ * 
+ * Any class having the same interface as the software SPI can be passed as `spi` instead, e.g. HardwareSPI 
+ * or USISPI, in which case DIN and CLK pins are not used and can be UnusedPin. (Note that the chip is specified 
+ * for up to 4MHz, though it is usually fine with F_CPU / 2 of the hardware SPI as well.)
+ * 
+ * Rows of the display are the pages of Display8, so its text and drawing functions, as well as Display8Console, 
+ * work here too.
  */
 template<
    typename pinRST, typename pinCE, typename pinDC, typename pinDIN, typename pinCLK, 
-   uint32_t maxFrequency = 4000000L
+   uint32_t maxFrequency = 4000000L,
+   typename spi = SPI<pinDIN, pinCLK, pinCE, maxFrequency>
 >
-class PCD8544 {
+class PCD8544 : public Display8< PCD8544<pinRST, pinCE, pinDC, pinDIN, pinCLK, maxFrequency, spi> > {
   
 public:
   
@@ -31,17 +40,37 @@ public:
     NormalVideo
   };
   
+  /** Defines how the column and row addresses advance after every data byte. */
+  enum AddressingMode : uint8_t {
+    /** The column is incremented first, then the row. This is the default. */
+    AddressingModeHorizontal,
+    /** The row is incremented first, then the column. */
+    AddressingModeVertical
+  };
+  
 private:
   
-  typedef SPI<pinDIN, pinCLK, pinCE, maxFrequency> spi;
+  typedef PCD8544<pinRST, pinCE, pinDC, pinDIN, pinCLK, maxFrequency, spi> Self;
+  
+  AddressingMode _addressingMode;
+  
+  static Self& getSelf() {
+    static Self self;
+    return self;
+  }
   
   enum ValueType : uint8_t {
     Command,
     Data
   };
   
-  static inline void write(ValueType valueType, uint8_t value) {
+  /** Sets the DC line, so the following bytes are treated as commands or data. */
+  static inline void setValueType(ValueType valueType) {
     pinDC::write(valueType == Data);
+  }
+  
+  static inline void write(ValueType valueType, uint8_t value) {
+    setValueType(valueType);
     spi::write(value);
   }  
 
@@ -98,19 +127,76 @@ private:
     SetVopMask = 0x7F
   };
 
-  static inline void extendedCommandSet(bool extended) {
+  static inline void functionSet(bool extended, AddressingMode mode) {
     write(
       Command, 
-      extended ? (FunctionSet | FunctionSetH) & ~(FunctionSetPD | FunctionSetV) 
-        : (FunctionSet | 0) & ~(FunctionSetPD | FunctionSetV | FunctionSetH)
+      FunctionSet | (extended ? FunctionSetH : 0) | (mode == AddressingModeVertical ? FunctionSetV : 0)
     );
   }
   
+  static inline void extendedCommandSet(bool extended) {
+    functionSet(extended, getSelf()._addressingMode);
+  }
+  
+  // Column-major rectangle output shared by writeRect() and writeRect_P().
+  template<bool progmem>
+  static void writeRectInternal(uint8_t col, uint8_t row, uint8_t cols, uint8_t rows, const uint8_t *data) {
+    
+    beginWriting();
+    
+    AddressingMode mode = getSelf()._addressingMode;
+    if (mode != AddressingModeVertical) {
+      functionSet(false, AddressingModeVertical);
+    }
+    
+    if (rows == Rows) {
+      // The address wraps to the next column at the bottom of the display, so everything goes in a single burst.
+      setAddressInternal(col, 0);
+      setValueType(Data);
+      writeData<progmem>(data, (uint16_t)cols * rows);
+    } else {
+      // There is no way to limit the rows, so every column has to be addressed, though still within a single burst.
+      const uint8_t *src = data;
+      for (uint8_t c = 0; c < cols; c++) {
+        setAddressInternal(col + c, row);
+        setValueType(Data);
+        writeData<progmem>(src, rows);
+        src += rows;
+      }
+    }
+    
+    if (mode != AddressingModeVertical) {
+      functionSet(false, mode);
+    }
+    
+    endWriting();
+  }
+  
+  static void fill(uint8_t pattern, uint16_t count) {
+    if (pattern == 0) {
+      spi::template repeat<0>(count);
+    } else if (pattern == 0xFF) {
+      spi::template repeat<0xFF>(count);
+    } else {
+      spi::repeat(pattern, count);
+    }
+  }
+  
+  template<bool progmem>
+  static inline void writeData(const uint8_t *data, uint16_t data_length) {
+    if (progmem) {
+      spi::write_P(data, data_length);
+    } else {
+      spi::write(data, data_length);
+    }
+  }
+  
   static inline void setAddressInternal(uint8_t col, uint8_t row) {
     // Assuming that we are not in the extended command set by default.
     //~ extendedCommandSet(false);
-    write(Command, SetXAddress | col);
-    write(Command, SetYAddress | row);
+    setValueType(Command);
+    spi::write(SetXAddress | col);
+    spi::write(SetYAddress | row);
   }
   
   static inline void config(Flags flags, uint8_t operatingVoltage, uint8_t biasSystem, uint8_t temperatureControl) {
@@ -140,6 +226,12 @@ public:
   static const uint8_t Width = Cols;
   static const uint8_t Height = Rows * 8;
   
+  /** Rows are called pages in Display8 terms. */
+  static const uint8_t Pages = Rows;
+  
+  /** Re-addressing costs 2 command bytes, see ShadowDisplay8. */
+  static const uint8_t PageAddressingOverhead = 2;
+  
   /** Maximum value for the parameter of operatingVoltage function, though the actual usable values are usually much smaller. */
   static const uint8_t MaxVoltage = 0x7F;
 
@@ -157,13 +249,39 @@ public:
     endWriting();
   }
 
-  /** Clears the display. */
-  static void clear() {
+  /** Fills a row-aligned rectangle, the same as Display8::clear() but via fillRect(). */
+  static void clear(
+    uint8_t start_col = 0, 
+    uint8_t start_row = 0, 
+    uint8_t end_col = Cols - 1, 
+    uint8_t end_row = Rows - 1, 
+    uint8_t mask = 0
+  ) {
+    fillRect(start_col, start_row, end_col + 1 - start_col, end_row + 1 - start_row, mask);
+  }
+  
+  /** 
+   * Fills `width` columns of `height` rows starting at the given column and row with the same byte 
+   * (i.e. a vertical pattern of 8 pixels repeated across the rectangle), all within a single burst. 
+   * Full-width rectangles need to be addressed only once. Clearing (0x00) and filling (0xFF) use the loops 
+   * of the SPI specialized for these values.
+   */
+  static void fillRect(uint8_t col, uint8_t row, uint8_t width, uint8_t height, uint8_t pattern) {
+    
     beginWriting();
-    setAddressInternal(0, 0);
-    for (int i = 0; i < Rows * Cols; i++) {
-      write(Data, 0);
+    
+    if (col == 0 && width == Cols) {
+      setAddressInternal(0, row);
+      setValueType(Data);
+      fill(pattern, (uint16_t)width * height);
+    } else {
+      for (uint8_t r = row; r < row + height; r++) {
+        setAddressInternal(col, r);
+        setValueType(Data);
+        fill(pattern, width);
+      }
     }
+    
     endWriting();
   }
       
@@ -206,10 +324,8 @@ public:
   static void writeRow(uint8_t col, uint8_t row, const uint8_t *data, uint16_t data_length) {
     beginWriting();
     setAddressInternal(col, row);
-    const uint8_t *src = data;
-    for (uint16_t c = data_length; c > 0; c--) {
-      write(Data, *src++);
-    }
+    setValueType(Data);
+    spi::write(data, data_length);
     endWriting();
   }
 
@@ -219,327 +335,78 @@ public:
   static void fillRow(uint8_t col, uint8_t row, uint8_t filler, uint8_t length) {
     beginWriting();
     setAddressInternal(col, row);
-    for (uint8_t c = length; c > 0; c--) {
-      write(Data, filler);
-    }
+    setValueType(Data);
+    fill(filler, length);
     endWriting();
   }
   
-  //
-  // Support for simple 8px high fonts fitting rows of the display exactly
-  // TODO: move into its own template, can be used with other displays
-  //
-  
-  /** 
-   * Returns the width of the glyph corresponding to a character in the given font and, if a buffer is provided, 
-   * copies glyph's bitmap bytes into it. 
-   */
-  static uint8_t dataForCharacter(PCD8544Font font, char ch, uint8_t *buffer) {
- 
-    const uint8_t *p = font;
-
-    uint8_t options = pgm_read_byte(p++);
-    if ((options & 1) && 'a' <= ch && ch <= 'z') {
-      ch = ch - 'a' + 'A';
-    }
-
-    while (true) {
-
-      // First character in the range (0 would mean no more ranges are defined).
-      uint8_t first = pgm_read_byte(p++);
-      if (first == 0) 
-        break;
-
-      // Last character in the range.
-      uint8_t last = pgm_read_byte(p++);
-
-      // Number of bytes every character in the range occupies. 
-      uint8_t bytes_per_character = pgm_read_byte(p++);
-
-      if (first <= ch && ch <= last) {
-        
-        // Our character is in the range, let's copy the data for it.
-        
-        p += (ch - first) * bytes_per_character;
-        // The first byte of the glyph data is the actual width of the glyph.
-        uint8_t width = pgm_read_byte(p++);
-        // Copy the bitmap if the caller expects it.
-        if (buffer) {
-          memcpy_PF(buffer, (uint_farptr_t)p, width);
-        }
-
-        return width;
-      }
-
-      // Well, let's skip to the next range of characters.
-      p += (last + 1 - first) * bytes_per_character;      
-    }
-
-    // Let's return data for sort of a default character.
-    return dataForCharacter(font, '?', buffer);
-  }  
-
-  /** The width of the string drawn with the given font. */
-  static uint8_t textWidth(PCD8544Font font, const char *text) {
-    
-    char ch;
-    const char *src = text;
-    uint8_t result = 0;
-    while ((ch = *src++)) {      
-        uint8_t width = dataForCharacter(font, ch, NULL);
-        result += width + 1;
-    }
-    
-    return result;
-  }
-    
   /** 
-   * Renders a text string by sending the corresponding bytes directly to the LCD.
-   * The row and col parameters use LCD addressing system, where each rows occupies 8 pixels.
-   * The max_width parameter is not clipped to the actual width available.
-   * The xor_mask set to 0xFF or 0x7E can be used to render inverted text, for example.
+   * Sets the addressing mode used by the display from now on. Note that writeRow(), fillRow(), fillRect(), clear() and the page 
+   * output below assume the horizontal mode, while writeRect() works in either.
    */
-  static uint8_t drawText(
-    PCD8544Font font, 
-    const uint8_t col, 
-    const uint8_t row, 
-    const uint8_t max_width, 
-    const char *text, 
-    const uint8_t xor_mask = 0
-  ) {
-    
+  static void setAddressingMode(AddressingMode mode) {
+    getSelf()._addressingMode = mode;
     beginWriting();
-    
-    setAddressInternal(col, row);
-    
-    char ch;
-    const char *src = text;
-    
-    // Well, let's clip it just in case.
-    uint8_t m = Cols - col;
-    uint8_t width_left = max_width < m ? max_width : m;
-    
-    while ((ch = *src++)) {
-      
-        uint8_t bitmap[8];
-        uint8_t width = dataForCharacter(font, ch, bitmap);
-        
-        for (uint8_t i = 0; i < width; i++) {
-          write(Data, bitmap[i] ^ xor_mask);
-          if (--width_left == 0) {
-            endWriting();
-            return 0;
-          }
-        }
-        
-        write(Data, xor_mask);
-        if (--width_left == 0)
-          break;
-    }
-    
+    extendedCommandSet(false);
     endWriting();
-    
-    return max_width - width_left;
   }
   
-  /** Returns how many characters will fit max_width pixels without clipping. */
-  static uint8_t numberOfCharsFittingWidth(PCD8544Font font, const char *text, uint8_t max_width) {
-    
-    uint8_t result = 0;
-    
-    char ch;
-    const char *src = text;
-    uint8_t total_width = 0;
-    while ((ch = *src++)) {
-      uint8_t new_total_width = total_width + dataForCharacter(font, ch, NULL) + 1;
-      if (new_total_width > max_width)
-        break;
-      total_width = new_total_width;
-      result++;
-    }
-    
-    return result;
-  }
-  
-};
-
-/**
- * Turns a PCD8544 LCD into a simple text-only display with autoscrolling.
- * Note that we don't inherit Arduino's Print class to keep the compiled code size small.
- * TODO: this was moved to Display8Console. Get rid of it here.
- */
-template<typename lcd, typename font = PCD8544FontPixelstadTweaked>
-class PCD8544Console {
-  
-private:
-  
-  static const uint8_t MaxCols = lcd::Cols / 4;
-  
-  char _buffer[lcd::Rows][MaxCols + 1];
-  uint8_t _row;
-  uint8_t _col;
-  uint8_t _rowWidth;
-  uint8_t _filledRows;
-  bool _dirty;
-  
-  void lf() {
-    
-    _col = 0;
-    _rowWidth = 0;
-    
-    _row++;
-    if (_row >= lcd::Rows) {
-      _row = 0;
-    }
-    _filledRows++;
-    if (_filledRows >= lcd::Rows) {
-      _filledRows--;
-    }
-    _buffer[_row][_col] = 0;
+  /** 
+   * Transports a column-major bitmap into the rectangle of `cols` columns and `rows` rows (8 pixel lines each) 
+   * starting at the given column and row within a single burst, i.e. `rows` bytes of the first column, 
+   * then `rows` bytes of the second one, etc. Handy for tall glyphs and sprites. 
+   * The vertical addressing mode is used temporarily, the current mode is restored afterwards.
+   */
+  static void writeRect(uint8_t col, uint8_t row, uint8_t cols, uint8_t rows, const uint8_t *data) {
+    writeRectInternal<false>(col, row, cols, rows, data);
   }
   
-  void cr() {
-    _col = 0;
-    _rowWidth = 0;
+  /** Same as writeRect() but for the data in the flash memory (PROGMEM). */
+  static void writeRect_P(uint8_t col, uint8_t row, uint8_t cols, uint8_t rows, const uint8_t *data) {
+    writeRectInternal<true>(col, row, cols, rows, data);
   }
   
-public:
-  
-  PCD8544Console() 
-    : _row(0), _col(0), _rowWidth(0), _filledRows(0)
-  {}
-  
-  /** Clears the console without redrawing it on the LCD. */
-  void clear() {
-    _row = _filledRows = 0;
-    _col = 0;
-    _rowWidth = 0;
-    for (uint8_t row = 0; row < lcd::Rows; row++) {
-      _buffer[row][0] = 0;
-    }
-    _dirty = true;    
-  }
-  
-  /** Transfers the contents of the console buffer to the LCD. 
-   * Note that this is not called automatically for every print() function. */
-  void draw() {
-    
-    if (!_dirty)
-      return;
-    
-    _dirty = false;
-        
-    for (uint8_t i = 0; i < lcd::Rows; i++) {
-      
-      int8_t row_index = _row - _filledRows + i;
-      if (row_index < 0)
-        row_index += lcd::Rows;
-      
-      // Print the row and erase the space after the last character.
-      uint8_t width = lcd::drawText(font::font(), 0, i, lcd::Cols, _buffer[row_index]);
-      lcd::fillRow(width, i, 0, lcd::Cols - width);
-    }
-  }
-
-  void print(char ch) {
+  /** 
+   * Display8::writePages() within a single burst: `rows` rows of `cols` bytes each, row after row 
+   * (unlike writeRect() above). Full-width rectangles need to be addressed only once.
+   */
+  static void writePages(uint8_t col, uint8_t row, uint8_t cols, uint8_t rows, const uint8_t *data) {
     
-    if (ch >= ' ') {
+    beginWriting();
     
-      uint8_t width = lcd::dataForCharacter(font::font(), ch, NULL);
-      if (_col >= MaxCols || _rowWidth + width >= lcd::Cols) {
-        lf();        
+    if (col == 0 && cols == Cols) {
+      setAddressInternal(0, row);
+      setValueType(Data);
+      spi::write(data, (uint16_t)cols * rows);
+    } else {
+      for (uint8_t r = row; r < row + rows; r++, data += cols) {
+        setAddressInternal(col, r);
+        setValueType(Data);
+        spi::write(data, cols);
       }
-  
-      _buffer[_row][_col] = ch;
-      _col++;
-      _buffer[_row][_col] = 0;
-      _rowWidth += width + 1;
-            
-    } else if (ch == '\n') {
-      
-      lf();
-      
-    } else if (ch == '\r') {
-      
-      cr();      
     }
     
-    _dirty = true;
-  }
-  
-  void print(const char *str) {
-    const char *src = str;
-    char ch;
-    while (ch = *src++) {
-      print(ch);
-    }
-  }
-  
-  void print(FlashStringPtr str) {
-    const char *src = (const char *)str;
-    char ch;
-    while (ch = pgm_read_byte(src++)) {
-      print(ch);
-    }
-  }
-
-  void print(int n) {
-    char buf[5 + 2];
-    itoa(n, buf, 10);
-    print(buf);
+    endWriting();
   }
   
-  void print(unsigned int n) {
-    char buf[5 + 1];
-    utoa(n, buf, 10);
-    print(buf);
-  }
-    
-  void print(long n) {
-    char buf[10 + 2];
-    ltoa(n, buf, 10);
-    print(buf);
-  }
+  /** @{ */
+  /** Page output for Display8, every page is a single burst with DC set only once. */
   
-  void print(unsigned long n) {
-    char buf[10 + 1];
-    ltoa(n, buf, 10);
-    print(buf);
-  }
-    
-  void println(const char *str) {
-    print(str);
-    lf();
+  static void beginWritingPage(uint8_t col, uint8_t page) {
+    beginWriting();
+    setAddressInternal(col, page);
+    setValueType(Data);
   }
   
-  void println(FlashStringPtr str) {
-    print(str);
-    lf();
-  }  
-  
-  void println(int n) {
-    print(n);
-    lf();
+  static inline void writePageByte(uint8_t b) {
+    spi::write(b);
   }
   
-  void println(unsigned int n) {
-    print(n);
-    lf();
+  static void endWritingPage() {
+    endWriting();
   }
   
-  void println(long n) {
-    print(n);
-    lf();
-  }  
-  
-  void println(unsigned long n) {
-    print(n);
-    lf();
-  }  
-  
-  void println() {
-    lf();
-  }  
+  /** @} */
 };
 
 } // namespace
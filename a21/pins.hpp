@@ -9,6 +9,34 @@
 
 namespace a21 {
 
+/** 
+ * Disables interrupts for the lifetime of the object and then restores the previous state of the interrupt flag, 
+ * so unlike noInterrupts()/interrupts() pair it can be used within interrupt handlers as well.
+ */
+class InterruptLock {
+  
+#if defined(SREG)
+
+private:
+	
+	uint8_t _sreg;
+	
+public:
+	
+	InterruptLock() __attribute__((always_inline)) : _sreg(SREG) { cli(); }
+	~InterruptLock() __attribute__((always_inline)) { SREG = _sreg; }
+	
+#else
+
+public:
+	
+	// Nothing to lock, but user-provided so `InterruptLock lock;` does not look like an unused variable.
+	InterruptLock() {}
+	~InterruptLock() {}
+	
+#endif
+};
+
 /** 
  * A pin that is not connected anywhere.
  * This is handy when a template requires a pin, but it is actually optional, i.e can be left unconnected 
@@ -20,6 +48,13 @@ public:
 	
 	/** Can be handy for the user classes to know if the pin is actually unused, so any related actions can be skipped as well. */
 	static const bool unused = true;
+	
+	/** 
+	 * The port the pin belongs to ('B' for PORTB, etc) and the corresponding bit mask, if it is known at compile time.
+	 * This is only the case for FastPin, other pins use zeros here, so they are always accessed one by one.
+	 */
+	static const char portID = 0;
+	static const uint8_t mask = 0;
 
   static inline void setOutput() {}
   static inline void setInput(bool) { }
@@ -30,6 +65,27 @@ public:
   static inline void setLow() {}
   
   static inline void write(bool) { }
+  
+  static inline void toggle() {}
+  
+  /** 
+   * Switches the pin to input without touching its output level register, so the level preset with setLow() 
+   * is restored on the next setOutput(). This allows to drive open-drain lines (I2C) by changing the direction only.
+   */
+  static inline void release() {}
+  
+  /** @{ */
+  /** 
+   * Same as the above, but safe to use when an interrupt handler can change other pins of the same port 
+   * at the same time. See FastPin.
+   */
+  static inline void setOutputAtomic() {}
+  static inline void setInputAtomic(bool) {}
+  static inline void releaseAtomic() {}
+  static inline void setHighAtomic() {}
+  static inline void setLowAtomic() {}
+  static inline void writeAtomic(bool) {}
+  /** @} */
 };
 
 /** This is to invert the levels of a pin without changing the code using it. */
@@ -38,6 +94,9 @@ class InvertedPin {
 public:
 	
 	static const bool unused = false;
+	
+	static const char portID = 0;
+	static const uint8_t mask = 0;
 
   static inline void setOutput() { Pin::setOutput(); }
   static inline void setInput(bool pullup) { Pin::setInput(pullup); }
@@ -48,6 +107,17 @@ public:
   static inline void setLow() { Pin::setHigh(); }
   
   static inline void write(bool value) { Pin::write(!value); }
+  
+  static inline void toggle() { Pin::toggle(); }
+  
+  static inline void release() { Pin::release(); }
+  
+  static inline void setOutputAtomic() { Pin::setOutputAtomic(); }
+  static inline void setInputAtomic(bool pullup) { Pin::setInputAtomic(pullup); }
+  static inline void releaseAtomic() { Pin::releaseAtomic(); }
+  static inline void setHighAtomic() { Pin::setLowAtomic(); }
+  static inline void setLowAtomic() { Pin::setHighAtomic(); }
+  static inline void writeAtomic(bool value) { Pin::writeAtomic(!value); }
 };
 
 /** 
@@ -61,6 +131,9 @@ public:
   static const int Pin = pin;
 	
 	static const bool unused = false;
+	
+	static const char portID = 0;
+	static const uint8_t mask = 0;
 
   static inline void setOutput() {
     pinMode(pin, OUTPUT);
@@ -85,45 +158,158 @@ public:
   static inline void write(bool b) {
     digitalWrite(pin, b ? HIGH : LOW);
   }
+  
+  static inline void toggle() {
+    write(!read());
+  }
+  
+  // Note that pinMode() resets the output level to LOW as well, which is fine for open-drain lines.
+  static inline void release() {
+    pinMode(pin, INPUT);
+  }
+  
+  // The standard calls are disabling interrupts for the read-modify-write sequences already.
+  static inline void setOutputAtomic() { setOutput(); }
+  static inline void setInputAtomic(bool pullup) { setInput(pullup); }
+  static inline void releaseAtomic() { release(); }
+  static inline void setHighAtomic() { setHigh(); }
+  static inline void setLowAtomic() { setLow(); }
+  static inline void writeAtomic(bool b) { write(b); }
 };
 
+/**
+ * Registers of a single I/O port identified by its letter, e.g. FastPort<'B'> for PORTB, DDRB and PINB.
+ * FastPin is using these, which also allows to group pins sharing the same port at compile time (see PinBus).
+ * Only the ports actually present on the MCU are defined.
+ */
+template<char id>
+class FastPort;
+
+#if defined(A21_HOST)
+
+/**
+ * When building on a desktop machine (A21_HOST is defined) the ports are simulated with plain variables,
+ * so the drivers using FastPin can be compiled and unit-tested there. Ports 'A' to 'L' are available.
+ * The tests can check `port` and `ddr` registers of a port after an operation and set `in` to simulate input.
+ * (An Arduino.h shim with the usual basic definitions is still expected.)
+ */
+class HostPorts {
+public:
+	
+	struct Registers {
+		volatile uint8_t port;
+		volatile uint8_t ddr;
+		volatile uint8_t in;
+	};
+	
+	static Registers& registers(char id) {
+		static Registers _registers['L' - 'A' + 1];
+		return _registers[id - 'A'];
+	}
+};
+
+template<char id>
+class FastPort {
+public:
+	typedef volatile uint8_t *port_ptr;
+	static port_ptr port() { return &HostPorts::registers(id).port; }
+	static port_ptr ddr() { return &HostPorts::registers(id).ddr; }
+	static port_ptr in() { return &HostPorts::registers(id).in; }
+	static bool bitAccessible() { return true; }
+	static void toggle(uint8_t mask) { *port() ^= mask; }
+};
+
+#else
+
+// Note that I was using constexpr before instead of inline functions but later versions of GCC 
+// stopped supporting constexpr with numbers reinterpreted as pointers, something that all port addresses are.
+// Shame, this was useful and the restriction makes no sense for MCU-specific code we are dealing with,
+// see https://gcc.gnu.org/bugzilla/show_bug.cgi?id=49171#c18.
+#define A21_FAST_PORT(letter, id) \
+	template<> \
+	class FastPort<id> { \
+	public: \
+		typedef volatile uint8_t *port_ptr; \
+		static port_ptr port() __attribute__((always_inline)) { return &PORT##letter; } \
+		static port_ptr ddr() __attribute__((always_inline)) { return &DDR##letter; } \
+		static port_ptr in() __attribute__((always_inline)) { return &PIN##letter; } \
+		/* True if single bits of the port can be changed with sbi/cbi, i.e. atomically. */ \
+		static bool bitAccessible() __attribute__((always_inline)) { return _SFR_MEM_ADDR(PORT##letter) < __SFR_OFFSET + 0x20; } \
+		/* Writing ones into PIN register flips the corresponding bits of PORT in a single cycle. */ \
+		static void toggle(uint8_t mask) __attribute__((always_inline)) { PIN##letter = mask; } \
+	};
+
+#if defined(PORTA)
+A21_FAST_PORT(A, 'A')
+#endif
+#if defined(PORTB)
+A21_FAST_PORT(B, 'B')
+#endif
+#if defined(PORTC)
+A21_FAST_PORT(C, 'C')
+#endif
+#if defined(PORTD)
+A21_FAST_PORT(D, 'D')
+#endif
+#if defined(PORTE)
+A21_FAST_PORT(E, 'E')
+#endif
+#if defined(PORTF)
+A21_FAST_PORT(F, 'F')
+#endif
+#if defined(PORTG)
+A21_FAST_PORT(G, 'G')
+#endif
+#if defined(PORTH)
+A21_FAST_PORT(H, 'H')
+#endif
+#if defined(PORTJ)
+A21_FAST_PORT(J, 'J')
+#endif
+#if defined(PORTK)
+A21_FAST_PORT(K, 'K')
+#endif
+#if defined(PORTL)
+A21_FAST_PORT(L, 'L')
+#endif
+
+#undef A21_FAST_PORT
+
+#endif // A21_HOST
+
 /** 
  * Wrapper for a pin that uses single instruction access to the corresponding port. 
  * Handy when a pin needs to be manipulated very quickly.
  * Pin numbers correspond to the numbers used by digitalWrite() on Arduino and compatible boards 
- * (though we support only ATmega and ATtiny boards here for now).
+ * (though we support only ATmega and ATtiny boards here for now: ATtiny25/45/85, ATtiny24/44/84, ATmega328P, 
+ * ATmega32U4, ATmega1280/2560 and ATmega644P/1284P).
  */
 template<int pin>
 class FastPin {
     
 #pragma GCC optimize ("O2")
 		
-private:
-
-	typedef volatile uint8_t *port_ptr;
+public:
 	
 	// The MCU-specific parts below should provide the following definitions for the code that follows:
+	// static constexpr char portID; // The letter of the port the pin belongs to, see FastPort.
 	// static constexpr uint8_t mask; // A mask corresponding to our pin in the port registers.
-	// static port_ptr port(); // The corresponding PORT* register.
-	// static port_ptr ddr(); // DDR* register.
-	// static port_ptr in(); // PIN* register.
 	
 	// Note that it's assumed that the same mask is used for all registers, which is true only for currently 
 	// supported boards.	
-	
-	// Also note that I was using constexpr before instead of inline functions but later versions of GCC 
-	// stopped supporting constexpr with numbers reinterpreted as pointers, something that all port addresses are.
-	// Shame, this was useful and the restriction makes no sense for MCU-specific code we are dealing with,
-	// see https://gcc.gnu.org/bugzilla/show_bug.cgi?id=49171#c18.
+
+// Simulated ports when testing on a desktop machine, pins 0-7 -> PORTA0:7, 8-15 -> PORTB0:7, etc.
+#if defined(A21_HOST)
+
+	static constexpr char const portID = 'A' + pin / 8;
+	static constexpr uint8_t const mask = _BV(pin % 8);
 
 // ATTiny85-based boards, like Digispark.
-#if defined(__AVR_ATtiny25__) || defined(__AVR_ATtiny45__) || defined(__AVR_ATtiny85__)
+#elif defined(__AVR_ATtiny25__) || defined(__AVR_ATtiny45__) || defined(__AVR_ATtiny85__)
 
 	// Pins 0-7 -> PORTB0:8  
+	static constexpr char const portID = 'B';
 	static constexpr uint8_t const mask = _BV(pin);
-	static port_ptr port() __attribute__((always_inline)) { return &PORTB; }
-	static port_ptr ddr() __attribute__((always_inline)) { return &DDRB; }
-	static port_ptr in() __attribute__((always_inline)) { return &PINB; }
   
 // ATmega328-based boards, like Arduino Uno or Nano.
 #elif defined(__AVR_ATmega328P__)
@@ -132,15 +318,8 @@ private:
 	// Pins 8-13 -> PORTB0:5 (a crystal is connected to pins 6 and 7)
 	// Pins A0-A7 -> PORTC
 
+	static constexpr char const portID = pin <= 7 ? 'D' : ((pin < A0) ? 'B' : 'C');
 	static constexpr uint8_t const mask = _BV(pin <= 7 ? pin : ((pin < A0) ? pin - 8 : pin - A0));
-	
-	static port_ptr regForPin(port_ptr D, port_ptr B, port_ptr C) __attribute__((always_inline)) {
-		return pin <= 7 ? D : ((pin < A0) ? B : C);
-	}
-
-	static port_ptr port() __attribute__((always_inline)) { return regForPin(&PORTD, &PORTB, &PORTC); }
-	static port_ptr ddr() __attribute__((always_inline)) { return regForPin(&DDRD, &DDRB, &DDRC); }
-	static port_ptr in() __attribute__((always_inline)) { return regForPin(&PIND, &PINB, &PINC); }
 
 // ATmega32u4-based boards, like Arduino Leonardo and Micro.
 #elif defined(__AVR_ATmega32U4__)
@@ -168,26 +347,84 @@ private:
 	
 	static constexpr uint8_t mask = maskForPin();
 	
-	static port_ptr regForPin(port_ptr B, port_ptr C, port_ptr D, port_ptr E, port_ptr F) __attribute__((always_inline)) {
+	static constexpr char portForPin() {
 		return 
-			(pin == 8 || pin == 9 || pin == 10 || pin == 11 || pin == 14 || pin == 15 || pin == 16 || pin == 17 || pin == 26 || pin == 27 || pin == 28) ? B : (
-				(pin == 5 || pin == 13) ? C : (
-					(pin == 0 || pin == 1 || pin == 2 || pin == 3 || pin == 4 || pin == 6 || pin == 12 || pin == 24 || pin == 25 || pin == 29 || pin == 30) ? D : (
-						(pin == 7) ? E : (
-							(pin == 18 || pin == 19 || pin == 20 || pin == 21 || pin == 22 || pin == 23) ? F : 0
+			(pin == 8 || pin == 9 || pin == 10 || pin == 11 || pin == 14 || pin == 15 || pin == 16 || pin == 17 || pin == 26 || pin == 27 || pin == 28) ? 'B' : (
+				(pin == 5 || pin == 13) ? 'C' : (
+					(pin == 0 || pin == 1 || pin == 2 || pin == 3 || pin == 4 || pin == 6 || pin == 12 || pin == 24 || pin == 25 || pin == 29 || pin == 30) ? 'D' : (
+						(pin == 7) ? 'E' : (
+							(pin == 18 || pin == 19 || pin == 20 || pin == 21 || pin == 22 || pin == 23) ? 'F' : 0
 						)
 					)
 				)
 			);
 	}
 	
-	static port_ptr port() __attribute__((always_inline)) { return regForPin(&PORTB, &PORTC, &PORTD, &PORTE, &PORTF); }
-	static port_ptr ddr() __attribute__((always_inline)) { return regForPin(&DDRB, &DDRC, &DDRD, &DDRE, &DDRF); }
-	static port_ptr in() __attribute__((always_inline)) { return regForPin(&PINB, &PINC, &PIND, &PINE, &PINF); }
+	static constexpr char portID = portForPin();
+
+// ATmega2560/1280-based boards, like Arduino Mega.
+#elif defined(__AVR_ATmega2560__) || defined(__AVR_ATmega1280__)
+
+	// The mapping is irregular here as well, so using lookup strings for pins 0-69: a port letter and a bit number 
+	// for each pin. Indexing string literals is fine in constant expressions, so it's still done at compile time.
+	static constexpr char const portID = 
+		"EEEEGEHHHHBBBBJJHHDDDDAAAAAAAACCCCCCCCDGGGLLLLLLLLBBBBFFFFFFFFKKKKKKKK"[pin];
+	static constexpr uint8_t const mask = 
+		_BV("0145533456456710103210012345677654321072107654321032100123456701234567"[pin] - '0');
+
+// ATmega1284P/644P-based boards, like the ones using MightyCore.
+#elif defined(__AVR_ATmega1284P__) || defined(__AVR_ATmega1284__) || defined(__AVR_ATmega644P__) || defined(__AVR_ATmega644__)
+
+	// Assuming the "standard" pinout of MightyCore:
+	// Pins 0-7 -> PORTB0:7
+	// Pins 8-15 -> PORTD0:7
+	// Pins 16-23 -> PORTC0:7
+	// Pins 24-31 (A0-A7) -> PORTA0:7
+	static constexpr char const portID = "BDCA"[pin / 8];
+	static constexpr uint8_t const mask = _BV(pin % 8);
+
+// ATtiny84-based boards.
+#elif defined(__AVR_ATtiny24__) || defined(__AVR_ATtiny44__) || defined(__AVR_ATtiny84__)
+
+	// Assuming the "clockwise" pinout of ATTinyCore (the one of the original arduino-tiny core):
+	// Pins 0-7 -> PORTA0:7
+	// Pins 8, 9, 10 -> PORTB2, PORTB1, PORTB0
+	// Pin 11 -> PORTB3 (RESET)
+	static constexpr char const portID = pin <= 7 ? 'A' : 'B';
+	static constexpr uint8_t const mask = _BV(pin <= 7 ? pin : "2103"[pin - 8] - '0');
 	
 #else
 #error Your MCU is not supported by FastPin yet.    
 #endif // MCU defines
+
+private:
+	
+	typedef FastPort<portID> Port;
+	typedef volatile uint8_t *port_ptr;
+	
+	static port_ptr port() __attribute__((always_inline)) { return Port::port(); }
+	static port_ptr ddr() __attribute__((always_inline)) { return Port::ddr(); }
+	static port_ptr in() __attribute__((always_inline)) { return Port::in(); }
+	
+	// Sets or clears our bit in the given register, so the other bits are not affected even if they are changed
+	// by an interrupt handler at the same time. Note that single-bit updates of the registers in the lower I/O space 
+	// are compiled into sbi/cbi instructions, which are atomic, so we don't need to disable interrupts for them.
+	static inline void writeBitAtomic(port_ptr reg, bool b) __attribute__((always_inline)) {
+		if (Port::bitAccessible()) {
+			if (b) {
+				*reg |= mask;
+			} else {
+				*reg &= ~mask;
+			}
+		} else {
+			InterruptLock lock;
+			if (b) {
+				*reg |= mask;
+			} else {
+				*reg &= ~mask;
+			}
+		}
+	}
 	
 public:
 
@@ -229,65 +466,329 @@ public:
     }
   }
   
+  /** Flips the output level of the pin in a single cycle without a read-modify-write sequence, so it's atomic. */
+  static inline void toggle() __attribute__((always_inline)) {
+    Port::toggle(mask);
+  }
+  
+  /** 
+   * Switches the pin to input leaving the output register alone, see UnusedPin::release(). 
+   * With the output preset to LOW this and setOutput() are the only operations needed to drive an open-drain line.
+   */
+  static inline void release() __attribute__((always_inline)) {
+		*ddr() &= ~mask;
+  }
+  
+  /** @{ */
+  /** 
+   * Same as the above, but safe to use when an interrupt handler can change other pins of the same port.
+   * For the ports in the lower I/O space these are exactly the same as the regular versions (sbi/cbi are atomic),
+   * for the others interrupts are disabled for the duration of the read-modify-write sequence.
+   */
+  
+  static inline void setOutputAtomic() __attribute__((always_inline)) {
+    writeBitAtomic(ddr(), true);
+  }
+  
+  static inline void setInputAtomic(bool pullup) __attribute__((always_inline)) {
+    writeBitAtomic(ddr(), false);
+    writeBitAtomic(port(), pullup);
+  }
+  
+  static inline void releaseAtomic() __attribute__((always_inline)) {
+    writeBitAtomic(ddr(), false);
+  }
+  
+  static inline void setHighAtomic() __attribute__((always_inline)) {
+    writeBitAtomic(port(), true);
+  }
+  
+  static inline void setLowAtomic() __attribute__((always_inline)) {
+    writeBitAtomic(port(), false);
+  }
+  
+  static inline void writeAtomic(bool b) __attribute__((always_inline)) {
+    writeBitAtomic(port(), b);
+  }
+  
+  /** @} */
+  
 // Cannot seem to pop the options correctly, have to reset
 #pragma GCC reset_options
 
 }; // FastPin class
+
+/** 
+ * Compile-time helpers for PinBus: treats a list of pins as bits of a byte, the first pin being bit number `index`.
+ * Pins that are known to share a port (FastPin ones) are grouped, so every port register is accessed only once. 
+ */
+template<uint8_t index, typename... pins>
+class PinSet {
+public:
+	static constexpr uint8_t portMask(char) { return 0; }
+	static constexpr uint8_t busMask(char) { return 0; }
+	static constexpr bool usesPort(char) { return false; }
+	static constexpr int8_t portShift(char) { return 0; }
+	static constexpr bool isPortShifted(char, int8_t) { return true; }
+	template<char port> static inline uint8_t portBits(uint8_t) { return 0; }
+	template<char port> static inline uint8_t busBits(uint8_t) { return 0; }
+	template<typename all> static inline void setOutput() {}
+	template<typename all> static inline void setInput(bool) {}
+	template<typename all> static inline void write(uint8_t) {}
+	template<typename all> static inline uint8_t read() { return 0; }
+};
+
+/** All the pins of the `all` set living on the given port, accessed at once. */
+template<typename all, char port>
+class PinSetPort {
+  
+private:
+	
+	typedef FastPort<port> Port;
+
+	// All the port bits used by our pins.
+	static const uint8_t mask = all::portMask(port);
+	
+	// When pins occupy consecutive bits of the port in the same order they have on the bus, 
+	// then we can simply shift the whole byte instead of moving every bit separately.
+	static const int8_t shift = all::portShift(port);
+	static const bool shifted = all::isPortShifted(port, shift);
+	
+	static inline uint8_t portBits(uint8_t b) __attribute__((always_inline)) {
+		if (shifted) {
+			return (shift >= 0 ? (uint8_t)(b << (shift >= 0 ? shift : 0)) : (b >> (shift < 0 ? -shift : 0))) & mask;
+		} else {
+			return all::template portBits<port>(b);
+		}
+	}
+
+	static inline uint8_t busBits(uint8_t v) __attribute__((always_inline)) {
+		if (shifted) {
+			return shift >= 0 ? (v & mask) >> (shift >= 0 ? shift : 0) : (uint8_t)((v & mask) << (shift < 0 ? -shift : 0));
+		} else {
+			return all::template busBits<port>(v);
+		}
+	}
+	
+public:
+	
+	static inline void setOutput() __attribute__((always_inline)) {
+		*Port::ddr() |= mask;
+	}
+	
+	static inline void setInput(bool pullup) __attribute__((always_inline)) {
+		*Port::ddr() &= ~mask;
+		if (pullup) {
+			*Port::port() |= mask;
+		} else {
+			*Port::port() &= ~mask;
+		}
+	}
+	
+	static inline void write(uint8_t b) __attribute__((always_inline)) {
+		if (mask == 0xFF) {
+			// The whole port is ours, no need to preserve anything.
+			*Port::port() = portBits(b);
+		} else {
+			*Port::port() = (*Port::port() & ~mask) | portBits(b);
+		}
+	}
+	
+	static inline uint8_t read() __attribute__((always_inline)) {
+		return busBits(*Port::in());
+	}
+};
+
+/** 
+ * A single pin of a PinSet. The `mode` is 0 for pins that have to be accessed one by one, 1 for pins that are 
+ * handled as a part of their port group elsewhere, and 2 for the pin responsible for its port group.
+ */
+template<typename all, typename pin, uint8_t index, uint8_t mode>
+class PinSetItem {
+public:
+	static inline void setOutput() { pin::setOutput(); }
+	static inline void setInput(bool pullup) { pin::setInput(pullup); }
+	static inline void write(uint8_t b) __attribute__((always_inline)) { pin::write(b & _BV(index)); }
+	static inline uint8_t read() __attribute__((always_inline)) { return pin::read() ? _BV(index) : 0; }
+};
+
+template<typename all, typename pin, uint8_t index>
+class PinSetItem<all, pin, index, 1> {
+public:
+	static inline void setOutput() {}
+	static inline void setInput(bool) {}
+	static inline void write(uint8_t) {}
+	static inline uint8_t read() { return 0; }
+};
+
+template<typename all, typename pin, uint8_t index>
+class PinSetItem<all, pin, index, 2> : public PinSetPort<all, pin::portID> {
+};
+
+template<uint8_t index, typename pin, typename... rest>
+class PinSet<index, pin, rest...> {
+  
+private:
+	
+	typedef PinSet<index + 1, rest...> Rest;
+	
+	static constexpr bool isOnPort(char port) {
+		return pin::portID != 0 && pin::portID == port;
+	}
+	
+	static constexpr int8_t bitNumber(uint8_t mask) {
+		return (mask & 1) ? 0 : 1 + bitNumber(mask >> 1);
+	}
+	
+	static constexpr uint8_t shifted(uint8_t b, int8_t shift) {
+		return shift >= 0 ? (uint8_t)(b << shift) : (b >> -shift);
+	}
+	
+	// The last of the pins sharing a port is responsible for the whole group.
+	static const uint8_t mode = pin::portID == 0 ? 0 : (Rest::usesPort(pin::portID) ? 1 : 2);
+	
+	template<typename all>
+	using Item = PinSetItem<all, pin, index, mode>;
+	
+public:
+	
+	/** Port bits used by the pins of the set that are on the given port. */
+	static constexpr uint8_t portMask(char port) {
+		return (isOnPort(port) ? pin::mask : 0) | Rest::portMask(port);
+	}
+
+	/** Bus bits corresponding to the pins of the set that are on the given port. */
+	static constexpr uint8_t busMask(char port) {
+		return (isOnPort(port) ? _BV(index) : 0) | Rest::busMask(port);
+	}
+	
+	static constexpr bool usesPort(char port) {
+		return isOnPort(port) || Rest::usesPort(port);
+	}
+	
+	/** The difference between the port bit and the bus bit for the first pin on the given port. */
+	static constexpr int8_t portShift(char port) {
+		return isOnPort(port) ? bitNumber(pin::mask) - index : Rest::portShift(port);
+	}
+	
+	/** True, if all the pins on the given port are off by the same `shift` from their bus bits. */
+	static constexpr bool isPortShifted(char port, int8_t shift) {
+		return (!isOnPort(port) || pin::mask == shifted(_BV(index), shift)) && Rest::isPortShifted(port, shift);
+	}
+	
+	/** Port bits for the pins on the given port corresponding to the bus value `b`. */
+	template<char port>
+	static inline uint8_t portBits(uint8_t b) {
+		return ((isOnPort(port) && (b & _BV(index))) ? pin::mask : 0) | Rest::template portBits<port>(b);
+	}
+	
+	/** Bus bits for the pins on the given port corresponding to the value `v` of the port register. */
+	template<char port>
+	static inline uint8_t busBits(uint8_t v) {
+		return ((isOnPort(port) && (v & pin::mask)) ? _BV(index) : 0) | Rest::template busBits<port>(v);
+	}
+	
+	template<typename all>
+	static inline void setOutput() {
+		Item<all>::setOutput();
+		Rest::template setOutput<all>();
+	}
+	
+	template<typename all>
+	static inline void setInput(bool pullup) {
+		Item<all>::setInput(pullup);
+		Rest::template setInput<all>(pullup);
+	}
+	
+	template<typename all>
+	static inline void write(uint8_t b) {
+		Item<all>::write(b);
+		Rest::template write<all>(b);
+	}
+	
+	template<typename all>
+	static inline uint8_t read() {
+		return Item<all>::read() | Rest::template read<all>();
+	}
+};
 	
 /** 
  * This is to make a bunch of different pins appear as an 8-bit bus. 
+ * FastPin-based pins sharing a port are written with a single masked store (or a plain one when the bus occupies 
+ * the whole port in order, e.g. pins 0-7 on Uno) and are read with a single read of the port.
  */
 template<
   typename pinD0, typename pinD1, typename pinD2, typename pinD3, 
   typename pinD4, typename pinD5, typename pinD6, typename pinD7
 >
 class PinBus {
+
+private:
+	
+	typedef PinSet<0, pinD0, pinD1, pinD2, pinD3, pinD4, pinD5, pinD6, pinD7> Pins;
   
 public:
 
   static void setOutput() {
-     pinD0::setOutput();
-     pinD1::setOutput();
-     pinD2::setOutput();
-     pinD3::setOutput();
-     pinD4::setOutput();
-     pinD5::setOutput();
-     pinD6::setOutput();
-     pinD7::setOutput();
+    Pins::template setOutput<Pins>();
   }
 
   static void setInput(bool pullup = false) {
-     pinD0::setInput(pullup);
-     pinD1::setInput(pullup);
-     pinD2::setInput(pullup);
-     pinD3::setInput(pullup);
-     pinD4::setInput(pullup);
-     pinD5::setInput(pullup);
-     pinD6::setInput(pullup);
-     pinD7::setInput(pullup);
+    Pins::template setInput<Pins>(pullup);
   }
 
   static void write(uint8_t b) {
-    pinD0::write(b & (1 << 0));
-    pinD1::write(b & (1 << 1));
-    pinD2::write(b & (1 << 2));
-    pinD3::write(b & (1 << 3));
-    pinD4::write(b & (1 << 4));
-    pinD5::write(b & (1 << 5));
-    pinD6::write(b & (1 << 6));
-    pinD7::write(b & (1 << 7));
+    Pins::template write<Pins>(b);
   }
 
   static uint8_t read() {
-    return (pinD0::read() << 0)
-      | (pinD1::read() << 1)
-      | (pinD2::read() << 2)
-      | (pinD3::read() << 3)
-      | (pinD4::read() << 4)
-      | (pinD5::read() << 5)
-      | (pinD6::read() << 6)
-      | (pinD7::read() << 7);
+    return Pins::template read<Pins>();
   }
+  
+  /** 
+   * Same as write(), but safe to use when an interrupt handler can change other pins of the ports used by the bus.
+   * Interrupts are disabled while the read-modify-write sequences are performed.
+   */
+  static void writeAtomic(uint8_t b) {
+    InterruptLock lock;
+    write(b);
+  }
+};
+
+/**
+ * Samples the given pins at once, reading every PIN register involved only once, so the states of pins on the same 
+ * port are taken at the very same moment and the ones on different ports within a few cycles.
+ * Handy in pin change interrupt handlers, e.g. for quadrature encoders:
+ * \code
+ * PortSnapshot< FastPin<2>, FastPin<3> > pins;
+ * encoder.checkPins(pins.read<0>(), pins.read<1>());
+ * \endcode
+ */
+template<typename... pins>
+class PortSnapshot {
+  
+	static_assert(sizeof...(pins) <= 8, "PortSnapshot supports up to 8 pins");
+	
+private:
+	
+	typedef PinSet<0, pins...> Pins;
+	
+	uint8_t _bits;
+	
+public:
+	
+	PortSnapshot() : _bits(Pins::template read<Pins>()) {}
+	
+	/** The state of the pin with the given index in the list of template parameters. */
+	template<uint8_t index>
+	inline bool read() const {
+		return _bits & _BV(index);
+	}
+	
+	/** States of all the pins as a byte, the first pin corresponding to bit 0. */
+	inline uint8_t bits() const {
+		return _bits;
+	}
 };
 
 } // namespace
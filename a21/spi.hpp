@@ -15,12 +15,37 @@
 
 namespace a21 {
 
+/** SPI clock polarity (CPOL, bit 1) and phase (CPHA, bit 0). */
+enum SPIMode : uint8_t {
+  /** The clock is LOW when idle, the data is sampled on the rising edge. */
+  SPIMode0 = 0,
+  /** The clock is LOW when idle, the data is sampled on the falling edge. */
+  SPIMode1 = 1,
+  /** The clock is HIGH when idle, the data is sampled on the falling edge. */
+  SPIMode2 = 2,
+  /** The clock is HIGH when idle, the data is sampled on the rising edge. */
+  SPIMode3 = 3
+};
+
+/** The order the bits of every byte are sent and received. */
+enum SPIBitOrder : uint8_t {
+  SPIMSBFirst,
+  SPILSBFirst
+};
+
 /**
  * Software SPI which can use FastPin templates.
- * Supports only sending the data out for now, not clocking it in.
- * Assumes that each bit is clocked on the rising edge of the clock and that CE pin is active LOW.
+ * By default the data is only sent out, pass a pin as `pinMISO` to be able to clock it in as well via transfer().
+ * Unless a different `mode` is set, assumes that each bit is clocked on the rising edge of the clock.
+ * CE pin is always active LOW. The clock is kept at its idle level between the bits, so both edges are made 
+ * with FastPin::toggle().
  */
-template<typename pinMOSI, typename pinCLK, typename pinCE, unsigned long maxFrequency = 4000000>
+template<
+  typename pinMOSI, typename pinCLK, typename pinCE, unsigned long maxFrequency = 4000000,
+  typename pinMISO = UnusedPin<>,
+  SPIMode mode = SPIMode0,
+  SPIBitOrder bitOrder = SPIMSBFirst
+>
 class SPI {
   
 private:
@@ -32,29 +57,107 @@ private:
       #if defined(ARDUINO_ARCH_AVR)
       _delay_us(us);
       #else
-      delayMicroseconds(us);
+      ::delayMicroseconds(us);
       #endif
     }
   }
   
-  static inline void writeBit(bool b) __attribute__((always_inline)) {
-    
-    // Set the data bit, will have enough time to settle before the clock is raised,
-    // even with optimizations will take 5-6 cycles because of the branching involved.
-    pinMOSI::write(b);
+  // The idle level of the clock.
+  static const bool cpol = mode & 2;
+  
+  // True, if the data is sampled on the trailing edge of the clock rather than on the leading one.
+  static const bool cpha = mode & 1;
+  
+  // The `receive` parameter is always a constant, so the MISO line is not even touched when writing only.
+  static inline bool transferBit(bool b, bool receive) __attribute__((always_inline)) {
     
-    // Will clock the data bit out on the raising edge, so let's make sure it's LOW now.
-    // Will take at least 2 clock cycles.
-    pinCLK::setLow();
+    bool result = false;
     
-    delayMicroseconds(1000000.0 * (0.5 / maxFrequency - (5.0) / F_CPU));
+    if (!cpha) {
+      
+      // The clock is idle here. Set the data bit, it'll have enough time to settle before the leading edge,
+      // even with optimizations will take 5-6 cycles because of the branching involved.
+      pinMOSI::writeAtomic(b);
+      
+      delayMicroseconds(1000000.0 * (0.5 / maxFrequency - (5.0 + 1.0) / F_CPU));
 
-    // Clock it out!
-    pinCLK::setHigh();
+      // Clock it out on the leading edge! Toggling takes a single cycle and is atomic, so we are safe 
+      // even if an interrupt handler changes other pins of the same port.
+      pinCLK::toggle();
+      
+      if (receive) {
+        result = pinMISO::read();
+      }
 
-    delayMicroseconds(1000000.0 * (0.5 / maxFrequency - (2.0 + 2.0) / F_CPU));
+      delayMicroseconds(1000000.0 * (0.5 / maxFrequency - (receive ? 3.0 : 1.0) / F_CPU));
+      
+      // And back to idle.
+      pinCLK::toggle();
+      
+    } else {
+      
+      // The data is changed on the leading edge and sampled on the trailing one.
+      pinCLK::toggle();
+      
+      pinMOSI::writeAtomic(b);
+      
+      delayMicroseconds(1000000.0 * (0.5 / maxFrequency - (5.0 + 1.0) / F_CPU));
+      
+      pinCLK::toggle();
+      
+      if (receive) {
+        result = pinMISO::read();
+      }
+      
+      delayMicroseconds(1000000.0 * (0.5 / maxFrequency - (receive ? 3.0 : 1.0) / F_CPU));
+    }
+    
+    return result;
   }  
   
+  // Clocks out a bit without touching MOSI, i.e. repeats the last one. Same timing as transferBit() above.
+  static inline void clockBit() __attribute__((always_inline)) {
+    
+    if (!cpha) {
+      delayMicroseconds(1000000.0 * (0.5 / maxFrequency - 1.0 / F_CPU));
+      pinCLK::toggle();
+      delayMicroseconds(1000000.0 * (0.5 / maxFrequency - 1.0 / F_CPU));
+      pinCLK::toggle();
+    } else {
+      pinCLK::toggle();
+      delayMicroseconds(1000000.0 * (0.5 / maxFrequency - 1.0 / F_CPU));
+      pinCLK::toggle();
+      delayMicroseconds(1000000.0 * (0.5 / maxFrequency - 1.0 / F_CPU));
+    }
+  }
+  
+  static constexpr uint8_t bitMask(uint8_t i) {
+    return bitOrder == SPIMSBFirst ? (0x80 >> i) : (0x01 << i);
+  }
+  
+  static inline void transferMaskedBit(uint8_t value, uint8_t& result, uint8_t mask, bool receive) __attribute__((always_inline)) {
+    if (transferBit(value & mask, receive)) {
+      result |= mask;
+    }
+  }
+  
+  static inline uint8_t transferByte(uint8_t value, bool receive) __attribute__((always_inline)) {
+    uint8_t result = 0;
+    transferMaskedBit(value, result, bitMask(0), receive);
+    transferMaskedBit(value, result, bitMask(1), receive);
+    transferMaskedBit(value, result, bitMask(2), receive);
+    transferMaskedBit(value, result, bitMask(3), receive);
+    transferMaskedBit(value, result, bitMask(4), receive);
+    transferMaskedBit(value, result, bitMask(5), receive);
+    transferMaskedBit(value, result, bitMask(6), receive);
+    transferMaskedBit(value, result, bitMask(7), receive);
+    return result;
+  }
+  
+  static inline void writeByte(uint8_t value) __attribute__((always_inline)) {
+    transferByte(value, false);
+  }
+  
 public:
   
   /** Sets the mode for all the used pins. */
@@ -63,7 +166,9 @@ public:
     pinMOSI::setLow();
     
     pinCLK::setOutput();
-    pinCLK::setLow();
+    pinCLK::write(cpol);
+    
+    pinMISO::setInput(false);
     
     pinCE::setOutput();
     pinCE::setHigh();    
@@ -71,26 +176,594 @@ public:
 
   /** Enables the slave by setting CE low. */
   static void beginWriting() {
-    pinCLK::setLow();
+    pinCLK::write(cpol);
     pinCE::setLow();
   }
   
   /** Clocks out a single byte on the MOSI line. */
   static void write(uint8_t value) {
-    writeBit(value & _BV(7));
-    writeBit(value & _BV(6));
-    writeBit(value & _BV(5));
-    writeBit(value & _BV(4));
-    writeBit(value & _BV(3));
-    writeBit(value & _BV(2));
-    writeBit(value & _BV(1));
-    writeBit(value & _BV(0));
+    writeByte(value);
   }  
+  
+  /** @{ */
+  /** 
+   * Burst versions of write(), each is a single tight loop with the bits of every byte unrolled.
+   * Like write() they should be called between beginWriting() and endWriting().
+   */
+  
+  /** Clocks out a bunch of bytes from RAM. */
+  static void write(const uint8_t *data, uint16_t data_length) {
+    const uint8_t *src = data;
+    for (uint16_t i = data_length; i > 0; i--) {
+      writeByte(*src++);
+    }
+  }
+  
+  /** Clocks out a bunch of bytes from the flash memory (PROGMEM). */
+  static void write_P(const uint8_t *data, uint16_t data_length) {
+    const uint8_t *src = data;
+    for (uint16_t i = data_length; i > 0; i--) {
+      writeByte(pgm_read_byte(src++));
+    }
+  }
+  
+  /** Clocks out the same byte `count` times. */
+  static void repeat(uint8_t value, uint16_t count) {
+    for (uint16_t i = count; i > 0; i--) {
+      writeByte(value);
+    }
+  }
+  
+  /** 
+   * Same as repeat() above, but the byte is known at compile time, so the loop is specialized for it. 
+   * In particular, for 0x00 and 0xFF MOSI is set only once and then only the clock is toggled. 
+   */
+  template<uint8_t value>
+  static void repeat(uint16_t count) {
+    if (value == 0x00 || value == 0xFF) {
+      pinMOSI::writeAtomic(value);
+      for (uint16_t i = count; i > 0; i--) {
+        clockBit(); clockBit(); clockBit(); clockBit();
+        clockBit(); clockBit(); clockBit(); clockBit();
+      }
+    } else {
+      for (uint16_t i = count; i > 0; i--) {
+        writeByte(value);
+      }
+    }
+  }
+  
+  /** @} */
+  
+  /** @{ */
+  /** Full-duplex transfers, should be called between beginWriting() and endWriting() as well. */
+  
+  /** Clocks out a single byte on the MOSI line returning the one clocked in on the MISO line at the same time. */
+  static uint8_t transfer(uint8_t value) {
+    return transferByte(value, true);
+  }
+  
+  /** 
+   * Clocks out `data_length` bytes from `tx` storing the ones received at the same time into `rx`. 
+   * When `tx` is NULL, then 0xFF is sent for every byte, which is handy when only reading.
+   */
+  static void transfer(const uint8_t *tx, uint8_t *rx, uint16_t data_length) {
+    const uint8_t *src = tx;
+    uint8_t *dst = rx;
+    for (uint16_t i = data_length; i > 0; i--) {
+      *dst++ = transferByte(src ? *src++ : 0xFF, true);
+    }
+  }
+  
+  /** @} */
 
   /** Disables the slave by setting CE high. */
   static void endWriting() {
     pinCE::setHigh();
   }  
 };
+
+#if defined(SPCR)
+
+/**
+ * SPI using the hardware module of ATmega MCUs, has the same interface as the software SPI above, 
+ * so the drivers can use either. The SPI clock is F_CPU / clockDivider, where the divider can be 2, 4, 8, 16, 32, 
+ * 64 or 128. The mode and the bit order are the same as with the software version.
+ * MOSI, MISO and SCK pins are fixed by the hardware. Note that the hardware SS pin is set to output as well 
+ * (regardless of it being used as CE or not), otherwise the module could switch into slave mode when it goes LOW.
+ */
+template<
+  typename pinCE, 
+  uint8_t clockDivider = 2, 
+  SPIMode mode = SPIMode0, 
+  SPIBitOrder bitOrder = SPIMSBFirst
+>
+class HardwareSPI {
+  
+  static_assert(
+    clockDivider == 2 || clockDivider == 4 || clockDivider == 8 || clockDivider == 16 
+    || clockDivider == 32 || clockDivider == 64 || clockDivider == 128,
+    "The clock divider of the hardware SPI can be 2, 4, 8, 16, 32, 64 or 128"
+  );
+  
+private:
+  
+  // The dividers are selected by SPR1:SPR0 bits and doubled speed bit SPI2X:
+  // SPR1:SPR0  SPI2X = 0  SPI2X = 1
+  // 00         4          2
+  // 01         16         8
+  // 10         64         32
+  // 11         128        64
+  static const uint8_t spr = 
+    (clockDivider <= 4) ? 0 : (clockDivider <= 16 ? _BV(SPR0) : (clockDivider <= 64 ? _BV(SPR1) : _BV(SPR1) | _BV(SPR0)));
+  static const bool doubleSpeed = (clockDivider == 2 || clockDivider == 8 || clockDivider == 32);
+  
+  static inline uint8_t transferByte(uint8_t value) __attribute__((always_inline)) {
+    SPDR = value;
+    while (!(SPSR & _BV(SPIF)))
+      ;
+    return SPDR;
+  }
+  
+  static inline void writeByte(uint8_t value) __attribute__((always_inline)) {
+    SPDR = value;
+    while (!(SPSR & _BV(SPIF)))
+      ;
+  }
+  
+public:
+  
+  /** Sets the mode for all the used pins and configures the SPI module. */
+  static void begin() {
+    
+    FastPin<MOSI>::setOutput();
+    FastPin<MOSI>::setLow();
+    
+    FastPin<SCK>::setOutput();
+    FastPin<SCK>::write(mode & 2);
+    
+    FastPin<SS>::setOutput();
+    
+    pinCE::setOutput();
+    pinCE::setHigh();
+    
+    // Note that CPOL and CPHA bits are the same as the bits of our mode.
+    SPCR = _BV(SPE) | _BV(MSTR) 
+      | ((mode & 2) ? _BV(CPOL) : 0) | ((mode & 1) ? _BV(CPHA) : 0) 
+      | (bitOrder == SPILSBFirst ? _BV(DORD) : 0)
+      | spr;
+    SPSR = doubleSpeed ? _BV(SPI2X) : 0;
+  }
+  
+  /** Enables the slave by setting CE low. */
+  static void beginWriting() {
+    pinCE::setLow();
+  }
+  
+  /** Clocks out a single byte on the MOSI line. */
+  static void write(uint8_t value) {
+    writeByte(value);
+  }
+  
+  /** @{ */
+  /** Burst versions of write(), see the software SPI. */
+  
+  static void write(const uint8_t *data, uint16_t data_length) {
+    const uint8_t *src = data;
+    for (uint16_t i = data_length; i > 0; i--) {
+      writeByte(*src++);
+    }
+  }
+  
+  static void write_P(const uint8_t *data, uint16_t data_length) {
+    const uint8_t *src = data;
+    for (uint16_t i = data_length; i > 0; i--) {
+      writeByte(pgm_read_byte(src++));
+    }
+  }
+  
+  static void repeat(uint8_t value, uint16_t count) {
+    for (uint16_t i = count; i > 0; i--) {
+      writeByte(value);
+    }
+  }
+  
+  /** Same as repeat() above, but for the byte known at compile time, see SPI. */
+  template<uint8_t value>
+  static void repeat(uint16_t count) {
+    for (uint16_t i = count; i > 0; i--) {
+      writeByte(value);
+    }
+  }
+  
+  /** @} */
+  
+  /** @{ */
+  /** Full-duplex transfers, see the software SPI. */
+  
+  static uint8_t transfer(uint8_t value) {
+    return transferByte(value);
+  }
+  
+  static void transfer(const uint8_t *tx, uint8_t *rx, uint16_t data_length) {
+    const uint8_t *src = tx;
+    uint8_t *dst = rx;
+    for (uint16_t i = data_length; i > 0; i--) {
+      *dst++ = transferByte(src ? *src++ : 0xFF);
+    }
+  }
+  
+  /** @} */
+  
+  /** Disables the slave by setting CE high. */
+  static void endWriting() {
+    pinCE::setHigh();
+  }
+};
+
+/**
+ * Interrupt-driven SPI sender built on the hardware SPI module: the bytes are put into a queue of `queueSize` 
+ * entries and are clocked out in the background, so the caller can do something else meanwhile. 
+ * Has the same interface as other SPI classes here, so the drivers can use it too. The functions return immediately 
+ * unless the queue is full, in which case they wait for the space to become available.
+ *
+ * CE changes are queued along with the data. The same can be done with the DC pin of displays: pass QueuedDC 
+ * to the driver instead of the actual pin. For example:
+ * \code
+ * typedef AsyncSPI< FastPin<10>, FastPin<9> > LCDSPI;
+ * typedef PCD8544< FastPin<8>, FastPin<10>, LCDSPI::QueuedDC, UnusedPin<>, UnusedPin<>, 4000000L, LCDSPI > LCD;
+ * 
+ * ISR(SPI_STC_vect) {
+ *   LCDSPI::handleInterrupt();
+ * }
+ * \endcode
+ * 
+ * (We don't define the interrupt handler ourselves so this can be included into more than one compilation unit.)
+ *
+ * Note that there is no asynchronous version for USI, because clocking it in the background requires a timer.
+ */
+template<typename pinCE, typename pinDC = UnusedPin<>, uint8_t clockDivider = 2, uint8_t queueSize = 32>
+class AsyncSPI {
+  
+private:
+  
+  typedef AsyncSPI<pinCE, pinDC, clockDivider, queueSize> Self;
+  
+  // Every entry of the queue is either a byte to send or a pin change to perform before sending the next byte.
+  enum EntryType : uint8_t {
+    EntryData = 0,
+    EntryBeginWriting,
+    EntryEndWriting,
+    EntryDCLow,
+    EntryDCHigh
+  };
+  
+  volatile uint16_t _queue[queueSize];
+  volatile uint8_t _head;
+  volatile uint8_t _tail;
+  volatile bool _busy;
+  volatile bool _inCompletionHandler;
+  void (* volatile _completionHandler)();
+  
+  static Self& getSelf() {
+    static Self self;
+    return self;
+  }
+  
+  static inline uint8_t nextIndex(uint8_t i) {
+    return (i + 1 == queueSize) ? 0 : i + 1;
+  }
+  
+  // Performs the queued pin changes till the next byte, which is then sent. Called with interrupts disabled.
+  // The completion handler is called only when the queue is drained in the interrupt handler, i.e. after a byte 
+  // was actually sent, and not when push() performs the pin changes queued while idle.
+  static void sendNext(bool interrupt) {
+    
+    Self& self = getSelf();
+    
+    while (self._head != self._tail) {
+      
+      uint16_t entry = self._queue[self._head];
+      self._head = nextIndex(self._head);
+      
+      switch ((EntryType)(entry >> 8)) {
+        case EntryData:
+          SPDR = (uint8_t)entry;
+          return;
+        case EntryBeginWriting:
+          pinCE::setLow();
+          break;
+        case EntryEndWriting:
+          pinCE::setHigh();
+          break;
+        case EntryDCLow:
+          pinDC::setLow();
+          break;
+        case EntryDCHigh:
+          pinDC::setHigh();
+          break;
+      }
+    }
+    
+    // Nothing else to send.
+    self._busy = false;
+    if (interrupt && self._completionHandler) {
+      self._inCompletionHandler = true;
+      self._completionHandler();
+      self._inCompletionHandler = false;
+    }
+  }
+  
+  static bool push(EntryType type, uint8_t value = 0) {
+    
+    Self& self = getSelf();
+    
+    for (;;) {
+      
+      {
+        // The completion handler can push as well, so the slot is taken and filled in with interrupts disabled.
+        InterruptLock lock;
+        
+        uint8_t tail = nextIndex(self._tail);
+        if (tail != self._head) {
+          
+          self._queue[self._tail] = ((uint16_t)type << 8) | value;
+          self._tail = tail;
+          
+          if (!self._busy) {
+            self._busy = true;
+            sendNext(false);
+          }
+          
+          break;
+        }
+      }
+      
+      // The queue is full. Nobody is going to free the space while we are in the completion handler, 
+      // so the entry is dropped then. Otherwise waiting for the interrupt handler to send something.
+      if (self._inCompletionHandler)
+        return false;
+    }
+    
+    return true;
+  }
+  
+public:
+  
+  /** 
+   * To be passed to the drivers instead of the actual DC pin, so its changes happen in sync with the queued data.
+   * Supports only the subset of pin functions the display drivers need.
+   */
+  class QueuedDC {
+  public:
+    
+    static const bool unused = pinDC::unused;
+    static const char portID = 0;
+    static const uint8_t mask = 0;
+    
+    static inline void setOutput() { pinDC::setOutput(); }
+    static inline void setInput(bool pullup) { pinDC::setInput(pullup); }
+    static inline bool read() { return pinDC::read(); }
+    
+    static inline void setHigh() { push(EntryDCHigh); }
+    static inline void setLow() { push(EntryDCLow); }
+    static inline void write(bool b) { push(b ? EntryDCHigh : EntryDCLow); }
+  };
+  
+  /** Configures the pins and the SPI module, enabling its interrupt. */
+  static void begin() {
+    HardwareSPI<pinCE, clockDivider>::begin();
+    SPCR |= _BV(SPIE);
+  }
+  
+  /** Should be called from the SPI transfer complete interrupt handler (SPI_STC_vect). */
+  static inline void handleInterrupt() {
+    sendNext(true);
+  }
+  
+  /** 
+   * The handler is called from the interrupt handler every time the queue becomes empty after sending. 
+   * Should be quick and can queue more data, but no more than `queueSize - 1` entries (bytes and pin changes) 
+   * per call: the queue cannot be drained while in the handler, so the entries not fitting are dropped.
+   */
+  static void setCompletionHandler(void (*handler)()) {
+    getSelf()._completionHandler = handler;
+  }
+  
+  /** True, if there is still something in the queue or being sent. */
+  static bool busy() {
+    return getSelf()._busy;
+  }
+  
+  /** Waits till everything queued so far is sent. */
+  static void flush() {
+    while (busy())
+      ;
+  }
+  
+  /** Queues enabling of the slave. */
+  static void beginWriting() {
+    push(EntryBeginWriting);
+  }
+  
+  /** Queues a single byte. */
+  static void write(uint8_t value) {
+    push(EntryData, value);
+  }
+  
+  /** @{ */
+  /** Burst versions of write(), the data is copied into the queue. */
+  
+  static void write(const uint8_t *data, uint16_t data_length) {
+    const uint8_t *src = data;
+    for (uint16_t i = data_length; i > 0; i--) {
+      if (!push(EntryData, *src++))
+        break;
+    }
+  }
+  
+  static void write_P(const uint8_t *data, uint16_t data_length) {
+    const uint8_t *src = data;
+    for (uint16_t i = data_length; i > 0; i--) {
+      if (!push(EntryData, pgm_read_byte(src++)))
+        break;
+    }
+  }
+  
+  static void repeat(uint8_t value, uint16_t count) {
+    for (uint16_t i = count; i > 0; i--) {
+      if (!push(EntryData, value))
+        break;
+    }
+  }
+  
+  /** Same as repeat() above, for compatibility with the other SPI classes. */
+  template<uint8_t value>
+  static void repeat(uint16_t count) {
+    repeat(value, count);
+  }
+  
+  /** @} */
+  
+  /** Queues disabling of the slave, which happens after the last byte queued before is sent. */
+  static void endWriting() {
+    push(EntryEndWriting);
+  }
+};
+
+#endif // SPCR
+
+#if defined(USICR)
+
+/**
+ * SPI using the USI module of ATtiny MCUs in three-wire mode, has the same interface as the software SPI above.
+ * The clock is strobed by software as fast as possible, i.e. at F_CPU / 2. Only SPI mode 0, MSB first is supported.
+ * DO, DI and USCK pins are fixed by the hardware: PB1, PB0 and PB2 on ATtiny25/45/85, PA5, PA6 and PA4 on ATtiny24/44/84.
+ */
+template<typename pinCE>
+class USISPI {
+  
+private:
+  
+#if defined(__AVR_ATtiny25__) || defined(__AVR_ATtiny45__) || defined(__AVR_ATtiny85__)
+  typedef FastPin<1> pinDO;
+  typedef FastPin<2> pinUSCK;
+#elif defined(__AVR_ATtiny24__) || defined(__AVR_ATtiny44__) || defined(__AVR_ATtiny84__)
+  typedef FastPin<5> pinDO;
+  typedef FastPin<4> pinUSCK;
+#else
+#error USISPI does not know the pins of your MCU yet.
+#endif
+  
+  // Every write of the first value toggles USCK (the rising edge), the second one toggles it back and shifts 
+  // the data register, so the next bit appears on DO.
+  static inline void clock() __attribute__((always_inline)) {
+    USICR = _BV(USIWM0) | _BV(USITC);
+    USICR = _BV(USIWM0) | _BV(USITC) | _BV(USICLK);
+  }
+  
+  static inline void writeByte(uint8_t value) __attribute__((always_inline)) {
+    USIDR = value;
+    clock();
+    clock();
+    clock();
+    clock();
+    clock();
+    clock();
+    clock();
+    clock();
+  }
+  
+  // The bits received on DI are shifted into the data register at the same time.
+  static inline uint8_t transferByte(uint8_t value) __attribute__((always_inline)) {
+    writeByte(value);
+    return USIDR;
+  }
+  
+public:
+  
+  /** Sets the mode for all the used pins and configures the USI module. */
+  static void begin() {
+    
+    pinDO::setOutput();
+    pinDO::setLow();
+    
+    pinUSCK::setOutput();
+    pinUSCK::setLow();
+    
+    pinCE::setOutput();
+    pinCE::setHigh();
+    
+    // Three-wire mode, the clock is driven by software strobes.
+    USICR = _BV(USIWM0);
+  }
+  
+  /** Enables the slave by setting CE low. */
+  static void beginWriting() {
+    pinCE::setLow();
+  }
+  
+  /** Clocks out a single byte on the DO line. */
+  static void write(uint8_t value) {
+    writeByte(value);
+  }
+  
+  /** @{ */
+  /** Burst versions of write(), see the software SPI. */
+  
+  static void write(const uint8_t *data, uint16_t data_length) {
+    const uint8_t *src = data;
+    for (uint16_t i = data_length; i > 0; i--) {
+      writeByte(*src++);
+    }
+  }
+  
+  static void write_P(const uint8_t *data, uint16_t data_length) {
+    const uint8_t *src = data;
+    for (uint16_t i = data_length; i > 0; i--) {
+      writeByte(pgm_read_byte(src++));
+    }
+  }
+  
+  static void repeat(uint8_t value, uint16_t count) {
+    for (uint16_t i = count; i > 0; i--) {
+      writeByte(value);
+    }
+  }
+  
+  /** Same as repeat() above, but for the byte known at compile time, see SPI. */
+  template<uint8_t value>
+  static void repeat(uint16_t count) {
+    for (uint16_t i = count; i > 0; i--) {
+      writeByte(value);
+    }
+  }
+  
+  /** @} */
+  
+  /** @{ */
+  /** Full-duplex transfers, see the software SPI. */
+  
+  static uint8_t transfer(uint8_t value) {
+    return transferByte(value);
+  }
+  
+  static void transfer(const uint8_t *tx, uint8_t *rx, uint16_t data_length) {
+    const uint8_t *src = tx;
+    uint8_t *dst = rx;
+    for (uint16_t i = data_length; i > 0; i--) {
+      *dst++ = transferByte(src ? *src++ : 0xFF);
+    }
+  }
+  
+  /** @} */
+  
+  /** Disables the slave by setting CE high. */
+  static void endWriting() {
+    pinCE::setHigh();
+  }
+};
+
+#endif // USICR
   
 } // namespace
@@ -7,11 +7,184 @@
 
 #include "font8.hpp"
 #include "display8.hpp"
+#include "pins.hpp"
+#include "clock.hpp"
+#include "i2c.hpp"
 
 namespace a21 {
 	  
+/**
+ * I2C transport for SSD1306Controller: every command or data sequence is a separate I2C transaction 
+ * with a control byte telling the controller what follows.
+ *
+ * With AsyncI2C the data blocks of writeData() are submitted as is, without copying them into the buffer 
+ * of the bus, so they should stay the same till the corresponding transactions are complete (see AsyncI2C::flush()).
+ */
+template<typename i2c, uint8_t slave_address = 0x3C>
+class SSD1306I2CTransport {
+private:
+	
+	// Sending of a whole block of data in a single transaction, the generic version copies it byte by byte.
+	template<typename bus, typename dummy = void>
+	class DataBlock {
+	public:
+		
+		static bool write(const uint8_t *data, uint16_t data_length) {
+			bool result = i2c::startWriting(slave_address) && i2c::write(0x40) && i2c::write(data, data_length);
+			i2c::stop();
+			return result;
+		}
+		
+		static bool write_P(const uint8_t *data, uint16_t data_length) {
+			bool result = i2c::startWriting(slave_address) && i2c::write(0x40);
+			for (uint16_t i = data_length; result && i > 0; i--) {
+				result = i2c::write(pgm_read_byte(data++));
+			}
+			i2c::stop();
+			return result;
+		}
+	};
+	
+#if defined(TWCR)
+	
+	// AsyncI2C can send the data directly from where it is, with the control byte as the prefix.
+	template<uint32_t frequency, bool builtInPullups, uint8_t queueSize, uint8_t bufferSize, typename dummy>
+	class DataBlock<AsyncI2C<frequency, builtInPullups, queueSize, bufferSize>, dummy> {
+	public:
+		
+		static bool write(const uint8_t *data, uint16_t data_length) {
+			return i2c::submit(slave_address, 0x40, data, data_length) != 0;
+		}
+		
+		static bool write_P(const uint8_t *data, uint16_t data_length) {
+			return i2c::submit_P(slave_address, 0x40, data, data_length) != 0;
+		}
+	};
+	
+#endif
+	
+public:
+	
+	/** What the addressing in SSD1306Controller::beginWritingPage() costs, see the controller. */
+	static const uint8_t PageAddressingOverhead = 10;
+	
+	/** The I2C bus is expected to be initialized by the user, it can be shared with other devices. */
+	static inline void begin() {}
+	
+	static inline bool beginCommand() {
+		return i2c::startWriting(slave_address) && i2c::write(0);
+	}
+	
+	static inline bool beginData() {
+		return i2c::startWriting(slave_address) && i2c::write(0x40);
+	}
+	
+	static inline bool write(uint8_t b) {
+		return i2c::write(b);
+	}
+	
+	static inline bool write(const uint8_t *data, uint16_t data_length) {
+		return i2c::write(data, data_length);
+	}
+	
+	static inline bool end() {
+		i2c::stop();
+		return true;
+	}
+	
+	/** @{ */
+	/** A complete data sequence, i.e. beginData(), write() and end() in one go. */
+	
+	static inline bool writeData(const uint8_t *data, uint16_t data_length) {
+		return DataBlock<i2c>::write(data, data_length);
+	}
+	
+	/** Same as writeData() but with the data in the flash memory (PROGMEM). */
+	static inline bool writeData_P(const uint8_t *data, uint16_t data_length) {
+		return DataBlock<i2c>::write_P(data, data_length);
+	}
+	
+	/** @} */
+};
+
+/**
+ * 4-wire SPI transport for SSD1306Controller. Any class having the interface of the software SPI can be used as `spi` 
+ * (the controller supports up to 10MHz in mode 0), its CE pin is the one of the display. The DC pin selects between 
+ * commands (LOW) and data (HIGH); the reset pin is optional. There are no acknowledgements on SPI, 
+ * so all the functions always succeed.
+ */
+template<typename spi, typename pinDC, typename pinRST = UnusedPin<> >
+class SSD1306SPITransport {
+public:
+	
+	/** Addressing a page is just 5 command bytes here. */
+	static const uint8_t PageAddressingOverhead = 5;
+	
+	/** Initializes the SPI and resets the display. */
+	static void begin() {
+		
+		spi::begin();
+		
+		pinDC::setOutput();
+		pinDC::setLow();
+		
+		if (!pinRST::unused) {
+			pinRST::setOutput();
+			pinRST::setLow();
+			// The reset pulse should be at least 3us.
+			delayMicroseconds(10);
+			pinRST::setHigh();
+		}
+	}
+	
+	static inline bool beginCommand() {
+		pinDC::setLow();
+		spi::beginWriting();
+		return true;
+	}
+	
+	static inline bool beginData() {
+		pinDC::setHigh();
+		spi::beginWriting();
+		return true;
+	}
+	
+	static inline bool write(uint8_t b) {
+		spi::write(b);
+		return true;
+	}
+	
+	static inline bool write(const uint8_t *data, uint16_t data_length) {
+		spi::write(data, data_length);
+		return true;
+	}
+	
+	static inline bool end() {
+		spi::endWriting();
+		return true;
+	}
+	
+	/** @{ */
+	/** A complete data sequence, i.e. beginData(), write() and end() in one go. */
+	
+	static inline bool writeData(const uint8_t *data, uint16_t data_length) {
+		beginData();
+		spi::write(data, data_length);
+		return end();
+	}
+	
+	static inline bool writeData_P(const uint8_t *data, uint16_t data_length) {
+		beginData();
+		spi::write_P(data, data_length);
+		return end();
+	}
+	
+	/** @} */
+};
+
 /** 
- * Wrapper for I2C OLED displays based on SSD1306 chip.
+ * Wrapper for OLED displays based on SSD1306 chip. The bus is abstracted by the `transport`, see SSD1306I2CTransport 
+ * and SSD1306SPITransport, though usually one of the SSD1306 or SSD1306SPI shortcuts below is used.
  * 
  * "Pages" are groups of 8 rows where each byte of the page is responsible for 8 pixels of a corresponding column. 
  * The least significant bits of every byte in the page determine the contents of the topmost 1-pixel row.
@@ -34,11 +207,11 @@ namespace a21 {
  * \endverbatim
  */
 template<
-	typename i2c, 
+	typename transport, 
 	uint8_t pages = 8,
-	uint8_t slave_address = 0x3C
+	typename Clock = ArduinoClock
 >
-class SSD1306 : public Display8< SSD1306<i2c, pages, slave_address> >{
+class SSD1306Controller : public Display8< SSD1306Controller<transport, pages, Clock> >{
 	
 public:
 	
@@ -46,68 +219,113 @@ public:
 	static const uint8_t Rows = 8 * pages;
 	static const uint8_t Cols = 128;
 	
-	typedef SSD1306<i2c, pages, slave_address> Self;
+	/** 
+	 * What beginWritingPage() costs in bytes: a command sequence with 5 commands bytes and then the start 
+	 * of the data sequence, which is more expensive on I2C. See ShadowDisplay8. 
+	 */
+	static const uint8_t PageAddressingOverhead = transport::PageAddressingOverhead;
+	
+	typedef SSD1306Controller<transport, pages, Clock> Self;
+	
+	/** See beginAsync() and poll(). */
+	enum InitState : uint8_t {
+		/** beginAsync() was not called yet. */
+		InitStateIdle,
+		/** Waiting for the display to respond. */
+		InitStateProbing,
+		/** The display is initialized. */
+		InitStateReady,
+		/** The display has not responded in time or has not accepted the initialization sequence. */
+		InitStateFailed
+	};
+	
+private:
+	
+	InitState _initState;
+	uint16_t _initStartTime;
+	uint16_t _initTimeout;
+	
+	static Self& getSelf() {
+		static Self self;
+		return self;
+	}
+	
+public:
 
 	/** @{ */
 	/** Low-level command/data access. */
 
 	/** Begins a sequence of command bytes. Must be paired with endCommand(). */
 	static bool beginCommand() {
-		return i2c::startWriting(slave_address) && i2c::write(0);
+		return transport::beginCommand();
 	}
 
 	/** Begins a sequence of data bytes. Must be paired with endData(). */
 	static bool beginData() {
-		return i2c::startWriting(slave_address) && i2c::write(0x40);
+		return transport::beginData();
 	}  
 
 	/** Writes a single data or command byte depending on the current mode. */
 	static inline bool write(uint8_t a) {
-		return i2c::write(a);
+		return transport::write(a);
 	}  
 
 	/** Writes 2 data or command byte depending on the current mode. */
 	static inline bool write(uint8_t a, uint8_t b) {
-		return i2c::write(a) && i2c::write(b);
+		return transport::write(a) && transport::write(b);
 	}
 
 	/** Writes 3 data or command byte depending on the current mode. */
 	static inline bool write(uint8_t a, uint8_t b, uint8_t c) {
-		return i2c::write(a) && i2c::write(b) && i2c::write(c);
+		return transport::write(a) && transport::write(b) && transport::write(c);
 	}
 
 	/** Ends the sequence of command bytes started with beginCommand(). */
 	static inline bool endCommand() {
-		i2c::stop();
-		return true;
+		return transport::end();
 	}
 
 	/** Ends the sequence of data bytes started with beginData(). */
 	static inline bool endData() {
-		i2c::stop();
-		return true;
+		return transport::end();
 	}  
 
 	/** @{ */
 	/** Shortcuts for 1-3 byte commands, replacing beginCommand()/write(a1)..write(a3)/endCommand() sequences. */
 
 	static inline bool writeCommand(uint8_t a) {
-		return beginCommand() && i2c::write(a) && endCommand();
+		return beginCommand() && write(a) && endCommand();
 	}    
 
 	static inline bool writeCommand(uint8_t a, uint8_t b) {
-		return beginCommand() && i2c::write(a) && i2c::write(b) && endCommand();
+		return beginCommand() && write(a, b) && endCommand();
 	}    
 
 	static inline bool writeCommand(uint8_t a, uint8_t b, uint8_t c) {
-		return beginCommand() && i2c::write(a) && i2c::write(b) && i2c::write(c) && endCommand();
+		return beginCommand() && write(a, b, c) && endCommand();
 	}
 	
 	/** @} */
 	
+	/** 
+	 * Sends a list of command bytes stored in the flash memory (PROGMEM) within a single transaction, 
+	 * which is much cheaper than sending the commands one by one via writeCommand(). 
+	 * Longer sequences with parameters known at run time can be sent via beginCommand()/write()/endCommand().
+	 */
+	static bool writeCommands_P(const uint8_t *commands, uint8_t count) {
+		bool result = beginCommand();
+		for (uint8_t i = 0; result && i < count; i++) {
+			result = write(pgm_read_byte(commands + i));
+		}
+		endCommand();
+		return result;
+	}
+	
 	/** The simplest initialization sequence. Feel free to use your own instead. */
 	static inline bool begin() {
 		
+		transport::begin();
+		
 		uint16_t tries = 0;
 		
 		// This seems to be the max start up time I observed.
@@ -119,15 +337,80 @@ public:
 		
 		while (tries++ <= max_tries) {
 			if (available()) {
-				return setZoomInEnabled(true) 
-					&& setContrast(0);
+				static const uint8_t commands[] PROGMEM = {
+					0xD6, 1, // "Set Zoom In", see setZoomInEnabled().
+					0x81, 0 // "Set Contrast Control", see setContrast().
+				};
+				return writeCommands_P(commands, sizeof(commands));
 			}
 		}
 		
 		return false;
 	}	
 	
-	/** Sends a NOP command and returns true if it was acknowledged. 
+	/** @{ */
+	/** 
+	 * Non-blocking alternative to begin(): beginAsync() starts the initialization and then poll() should be called 
+	 * periodically till it returns InitStateReady or InitStateFailed. Every poll() checks if the display responds 
+	 * (see available()) and once it does the whole initialization sequence is sent as a single command transaction: 
+	 * clock, multiplex ratio and COM pins matching the number of pages, charge pump, page addressing, 
+	 * no flipping, default contrast. The display is left turned off, see turnOn().
+	 * 
+	 * Note that with AsyncI2C the transactions are only queued here, so available() and the initialization 
+	 * always "succeed" and poll() reports InitStateReady on the first call even if there is no display on the bus. 
+	 * Use the `acked` flag passed to the completion handler of AsyncI2C to find out if the display has responded.
+	 */
+	
+	static void beginAsync(uint16_t timeout_ms = 1500) {
+		
+		transport::begin();
+		
+		Self& self = getSelf();
+		self._initState = InitStateProbing;
+		self._initStartTime = Clock::millis16();
+		self._initTimeout = timeout_ms;
+	}
+	
+	static InitState poll() {
+		
+		Self& self = getSelf();
+		
+		if (self._initState != InitStateProbing)
+			return self._initState;
+		
+		if (available()) {
+			
+			static const uint8_t commands[] PROGMEM = {
+				0xAE, // "Set Display ON/OFF" with "Display OFF".
+				0xD5, 0x80, // "Set Display Clock Divide Ratio/Oscillator Frequency", the reset value.
+				0xA8, Rows - 1, // "Set Multiplex Ratio".
+				0xD3, 0, // "Set Display Offset".
+				0x40, // "Set Display Start Line" to 0.
+				0x8D, 0x14, // "Charge Pump Setting" with "Enable charge pump during display on".
+				0x20, AddressingModePage, // "Set Memory Addressing Mode".
+				0xA0, // "Set Segment Re-map", see setFlippedVertically().
+				0xC0, // "Set COM Output Scan Direction", see setFlippedVertically().
+				0xDA, pages > 4 ? 0x12 : 0x02, // "Set COM Pins Hardware Configuration", alternative for 64 rows only.
+				0x81, 0x7F, // "Set Contrast Control", the reset value.
+				0xD9, 0xF1, // "Set Pre-charge Period" recommended with the internal charge pump.
+				0xDB, 0x40, // "Set VCOMH Deselect Level".
+				0xA4, // "Entire Display On" off, i.e. following the RAM.
+				0xA6 // "Set Normal/Inverse Display" with "Normal".
+			};
+			
+			self._initState = writeCommands_P(commands, sizeof(commands)) ? InitStateReady : InitStateFailed;
+			
+		} else if ((uint16_t)(Clock::millis16() - self._initStartTime) >= self._initTimeout) {
+			self._initState = InitStateFailed;
+		}
+		
+		return self._initState;
+	}
+	
+	/** @} */
+	
+	/** Sends a NOP command and returns true if it was acknowledged (always the case with SPI and AsyncI2C, 
+	 * where the command is only queued). 
 	 * Handy when checking if the display has finished its power on sequence and is ready to talk. */
 	static inline bool available() {
 		return writeCommand(0xE3); // NOP
@@ -135,10 +418,11 @@ public:
 
 	/** Turns the display on without trying to reset it or set addressing modes, etc. */
 	static inline bool turnOn() {
-		return beginCommand() 
-			&& write(0x8D, 0x14) // "Charge Pump Settings" command with "Enable charge pump during display on".
-			&& write(0xAF) // "Set Display ON/OFF" command with X0 bit being "Display ON".
-			&& endCommand();
+		static const uint8_t commands[] PROGMEM = {
+			0x8D, 0x14, // "Charge Pump Settings" command with "Enable charge pump during display on".
+			0xAF // "Set Display ON/OFF" command with X0 bit being "Display ON".
+		};
+		return writeCommands_P(commands, sizeof(commands));
 	}
 	
 	/** Turns the display off. */
@@ -265,17 +549,56 @@ public:
 	/** Allows to flip the output vertically. 
 	 * Handy when the display is mounted upside down but we want to use the same addressing. */
 	static inline bool setFlippedVertically(bool flipped) {
-		return writeCommand(flipped ? 0xC8 : 0xC0) // "Set COM Output Scan Direction"
-			&& writeCommand(flipped ? 0xA1 : 0xA0); // "Set Segment Re-map"
+		// "Set COM Output Scan Direction" and "Set Segment Re-map".
+		static const uint8_t flippedCommands[] PROGMEM = { 0xC8, 0xA1 };
+		static const uint8_t normalCommands[] PROGMEM = { 0xC0, 0xA0 };
+		return writeCommands_P(flipped ? flippedCommands : normalCommands, 2);
 	} 
 
+	/** @{ */
+	/** 
+	 * Uploading of rectangular areas of the display memory in horizontal addressing mode, where the addresses are set 
+	 * only once and all the bytes go within a single data transaction. The data is laid out page by page, 
+	 * i.e. `cols` bytes of the top page first, then `cols` bytes of the next one, etc. 
+	 * Note that the addressing mode is left horizontal, the page functions below switch it back when needed. 
+	 * With AsyncI2C these return once the data is queued, see SSD1306I2CTransport.
+	 */
+	
+	static bool writeRect(uint8_t col, uint8_t page, uint8_t cols, uint8_t pages_, const uint8_t *data) {
+		return setRect(col, page, cols, pages_) && transport::writeData(data, (uint16_t)cols * pages_);
+	}
+	
+	/** Same as writeRect() but with the data in the flash memory (PROGMEM). */
+	static bool writeRect_P(uint8_t col, uint8_t page, uint8_t cols, uint8_t pages_, const uint8_t *data) {
+		return setRect(col, page, cols, pages_) && transport::writeData_P(data, (uint16_t)cols * pages_);
+	}
+	
+	/** Page-by-page output for Display8::writePages(), here it's a single transfer with horizontal addressing. */
+	static inline void writePages(uint8_t col, uint8_t page, uint8_t cols, uint8_t pages_, const uint8_t *data) {
+		writeRect(col, page, cols, pages_, data);
+	}
+	
+	/** Uploads the whole frame, Cols * Pages bytes. */
+	static inline bool writeFrame(const uint8_t *data) {
+		return writeRect(0, 0, Cols, Pages, data);
+	}
+	
+	static inline bool writeFrame_P(const uint8_t *data) {
+		return writeRect_P(0, 0, Cols, Pages, data);
+	}
+	
+	/** @} */
+	
 	/** @{ */
 	/** Support for `MonochromeDisplayPageOutput`. */
 	
 	static inline void beginWritingPage(uint8_t col, uint8_t page) {
-		setAddressingMode(AddressingModePage);
-		pageModeSetPage(page);
-		pageModeSetStartColumn(col);
+		// The same as setAddressingMode(), pageModeSetPage() and pageModeSetStartColumn(), but in one transaction.
+		beginCommand()
+			&& write(0x20, AddressingModePage)
+			&& write(0xB0 | (page & 0x7))
+			&& write(0x00 | (col & 0x0F), 0x10 | (col >> 4));
+		endCommand();
 		beginData();
 	}
 	
@@ -289,11 +612,33 @@ public:
 	
 	/** @} */
 	
+private:
+	
+	/** Sets the addresses of the rectangle in horizontal addressing mode, the data should follow. */
+	static bool setRect(uint8_t col, uint8_t page, uint8_t cols, uint8_t pages_) {
+		bool result = beginCommand()
+			&& write(0x20, AddressingModeHorizontal) // "Set Memory Addressing Mode", see setAddressingMode().
+			&& write(0x21, col, col + cols - 1) // "Set Column Address", see setColumnAddresses().
+			&& write(0x22, page, page + pages_ - 1); // "Set Page Address", see setPageAddresses().
+		endCommand();
+		return result;
+	}
+	
+public:
+	
 	/** @{ */
 	/** Some basic drawing routines. See Display8 template. */ 
  
 	/** @} */
 };
 
+/** SSD1306 connected via I2C. */
+template<typename i2c, uint8_t pages = 8, uint8_t slave_address = 0x3C>
+using SSD1306 = SSD1306Controller< SSD1306I2CTransport<i2c, slave_address>, pages >;
+
+/** SSD1306 connected via 4-wire SPI. */
+template<typename spi, typename pinDC, typename pinRST = UnusedPin<>, uint8_t pages = 8>
+using SSD1306SPI = SSD1306Controller< SSD1306SPITransport<spi, pinDC, pinRST>, pages >;
+
 }; // namespace
 
@@ -18,7 +18,7 @@ typedef PCD8544< UnusedPin<>, UnusedPin<>, FastPin<5>, FastPin<4>, FastPin<0> >
 LCD lcd;
 
 // A simple text console that is able to render itself to the LCD.
-PCD8544Console<LCD, PCD8544FontPixelstadTweaked> console;
+Display8Console<LCD> console;
 
 void setup() {
   
@@ -27,8 +27,14 @@ EC11 encoder;
 const int encoderPinA = 2;
 const int encoderPinB = 3;
 
+// Both pins are sampled at once (with a single read of the port register on Uno), so we never see 
+// a mix of their states taken at different moments. (FastPin needs one of the boards listed in pins.hpp, 
+// use SlowPin as in the polling example below with other ones.)
+typedef PortSnapshot< FastPin<encoderPinA>, FastPin<encoderPinB> > EncoderPins;
+
 void pinDidChange() {
-  encoder.checkPins(digitalRead(encoderPinA), digitalRead(encoderPinB));
+  EncoderPins pins;
+  encoder.checkPins(pins.read<0>(), pins.read<1>());
 }
 
 void prepare() {
@@ -39,12 +45,15 @@ void prepare() {
 #else
 
 //
-// Polling allows to use the encoder with any digital input pin.
+// Polling allows to use the encoder with any digital input pin. SlowPin (i.e. digitalRead()) works on any board, 
+// though FastPin can be used instead when supported to sample both pins at once.
 //
 
 const int encoderPinA = 2;
 const int encoderPinB = 3;
 
+typedef PortSnapshot< SlowPin<encoderPinA>, SlowPin<encoderPinB> > EncoderPins;
+
 void prepare() {
 }
 
@@ -91,7 +100,8 @@ void loop() {
 
   // With polling-style pin checking we can still read infrequently, but we need to poll the pins often enough.
   for (int i = 0; i < 200; i++) {
-    encoder.checkPins(digitalRead(encoderPinA), digitalRead(encoderPinB));
+    EncoderPins pins;
+    encoder.checkPins(pins.read<0>(), pins.read<1>());
     delay(1);
   }
   